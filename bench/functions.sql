@@ -0,0 +1,83 @@
+-- Representative plpgsql functions for the overhead benchmark.
+
+-- A tiny function, the capture overhead per call matters most here.
+CREATE OR REPLACE FUNCTION bench_tiny(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 1;
+END;
+$$ LANGUAGE plpgsql;
+
+-- A loop with branches, little SQL per statement.
+CREATE OR REPLACE FUNCTION bench_loop(n integer) RETURNS integer AS $$
+DECLARE
+    s integer := 0;
+    i integer;
+BEGIN
+    FOR i IN 1..n LOOP
+        IF i % 3 = 0 THEN
+            s := s + i;
+        ELSIF i % 3 = 1 THEN
+            s := s - 1;
+        ELSE
+            s := s * 1;
+        END IF;
+        WHILE s > 1000000 LOOP
+            s := s / 2;
+        END LOOP;
+    END LOOP;
+    RETURN s;
+END;
+$$ LANGUAGE plpgsql;
+
+-- A function of more than 1000 statements, the graphs are expensive to build.
+DO $do$
+DECLARE
+    body text := '';
+BEGIN
+    FOR i IN 1..250 LOOP
+        body := body || format(
+            'v%1$s := a + %1$s;
+             IF v%1$s > %1$s THEN
+                 s := s + v%1$s;
+             END IF;
+             s := s %% 1000003;
+            ', i);
+    END LOOP;
+
+    EXECUTE format(
+        'CREATE OR REPLACE FUNCTION bench_large(a integer) RETURNS integer AS $f$
+         DECLARE
+             s integer := 0;
+             %s
+         BEGIN
+             %s
+             RETURN s;
+         END;
+         $f$ LANGUAGE plpgsql',
+        (SELECT string_agg(format('v%s integer;', i), ' ') FROM generate_series(1, 250) i),
+        body);
+END;
+$do$;
+
+-- A trigger function, called for every inserted row.
+CREATE UNLOGGED TABLE IF NOT EXISTS bench_trigger_target(
+    id bigserial PRIMARY KEY,
+    v integer,
+    doubled integer,
+    changed timestamptz
+);
+
+CREATE OR REPLACE FUNCTION bench_trigger() RETURNS trigger AS $$
+BEGIN
+    NEW.doubled := NEW.v * 2;
+    IF NEW.doubled > 100 THEN
+        NEW.doubled := 100;
+    END IF;
+    NEW.changed := now();
+    RETURN NEW;
+END;
+$$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS bench_trigger ON bench_trigger_target;
+CREATE TRIGGER bench_trigger BEFORE INSERT ON bench_trigger_target
+    FOR EACH ROW EXECUTE PROCEDURE bench_trigger();
@@ -0,0 +1,189 @@
+#!/bin/sh
+#
+# Overhead benchmark of pg_plsql_graphs.
+#
+# Creates a scratch cluster, loads the functions of functions.sql and runs
+# every workload of workloads/ with pgbench for each mode and number of
+# clients:
+#
+#   unloaded   the library is not in shared_preload_libraries
+#   off        the library is loaded, pg_plsql_graphs.capture = off
+#   capture    the library is loaded and captures (first-per-version)
+#
+# One CSV row per run is written to stdout (or the file given with -o):
+#
+#   mode,workload,clients,tps,avg_latency_ms,p99_latency_ms,lock_waits
+#
+# lock_waits is the number of times a backend had to wait for a partition
+# lock of the graph store during the run, empty if the library is not
+# loaded. Progress goes to stderr. The extension must be installed into
+# the installation of pg_config (make install). Nothing needs network
+# access, the server only listens on a unix socket.
+#
+# Environment:
+#   PG_CONFIG   pg_config of the installation to use (default: pg_config)
+#   MODES       modes to run (default: "unloaded off capture")
+#   WORKLOADS   workloads to run (default: all files in workloads/)
+#   CLIENTS     numbers of clients (default: "1 2 4 8 16 32 64")
+#   DURATION    seconds per run (default: 30)
+#   PORT        port of the scratch server (default: 54329)
+#   KEEP        keep the scratch cluster if set
+
+set -e
+
+usage() {
+    echo "usage: $0 [-o output.csv]" >&2
+    exit 1
+}
+
+OUTPUT=
+while getopts o: opt; do
+    case $opt in
+        o) OUTPUT=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+BENCHDIR=$(cd "$(dirname "$0")" && pwd)
+PG_CONFIG=${PG_CONFIG:-pg_config}
+BINDIR=$("$PG_CONFIG" --bindir)
+MODES=${MODES:-"unloaded off capture"}
+CLIENTS=${CLIENTS:-"1 2 4 8 16 32 64"}
+DURATION=${DURATION:-30}
+PORT=${PORT:-54329}
+if [ -z "$WORKLOADS" ]; then
+    WORKLOADS=$(cd "$BENCHDIR/workloads" && ls *.sql | sed 's/\.sql$//')
+fi
+
+if [ ! -f "$("$PG_CONFIG" --pkglibdir)/pg_plsql_graphs.so" ]; then
+    echo "pg_plsql_graphs is not installed into $("$PG_CONFIG" --pkglibdir), run make install" >&2
+    exit 1
+fi
+
+SCRATCH=$(mktemp -d "${TMPDIR:-/tmp}/pgpg_bench.XXXXXX")
+PGDATA=$SCRATCH/data
+SOCKDIR=$SCRATCH
+PSQL="$BINDIR/psql -X -q -v ON_ERROR_STOP=1 -h $SOCKDIR -p $PORT -d postgres"
+
+log() {
+    echo "$@" >&2
+}
+
+stop_server() {
+    "$BINDIR/pg_ctl" -D "$PGDATA" -m fast -w stop >/dev/null 2>&1 || true
+}
+
+cleanup() {
+    stop_server
+    if [ -z "$KEEP" ]; then
+        rm -rf "$SCRATCH"
+    else
+        log "scratch cluster kept in $SCRATCH"
+    fi
+}
+trap cleanup EXIT INT TERM
+
+# start the server with the settings of a mode
+start_server() {
+    mode=$1
+
+    case $mode in
+        unloaded) libs=""; capture="" ;;
+        off)      libs="pg_plsql_graphs"; capture="off" ;;
+        capture)  libs="pg_plsql_graphs"; capture="first-per-version" ;;
+        *) log "unknown mode $mode"; exit 1 ;;
+    esac
+
+    {
+        echo "shared_preload_libraries = '$libs'"
+        if [ -n "$capture" ]; then
+            echo "pg_plsql_graphs.capture = '$capture'"
+            # graphs of earlier modes must not be found in the store
+            echo "pg_plsql_graphs.save = off"
+        fi
+    } > "$PGDATA/bench_mode.conf"
+
+    "$BINDIR/pg_ctl" -D "$PGDATA" -l "$SCRATCH/server.log" -w start >/dev/null
+}
+
+# sum of the lock waits of all partitions, empty if the library is not loaded
+lock_waits() {
+    if [ "$1" = unloaded ]; then
+        echo ""
+    else
+        $PSQL -t -A -c "SELECT coalesce(sum(waits), 0) FROM pg_plsql_graphs_lock_waits()"
+    fi
+}
+
+log "creating the scratch cluster in $SCRATCH"
+"$BINDIR/initdb" -D "$PGDATA" -A trust -E UTF8 >/dev/null
+cat >> "$PGDATA/postgresql.conf" <<EOF
+listen_addresses = ''
+port = $PORT
+unix_socket_directories = '$SOCKDIR'
+max_connections = 200
+shared_buffers = 256MB
+fsync = off
+synchronous_commit = off
+include = 'bench_mode.conf'
+EOF
+echo "shared_preload_libraries = 'pg_plsql_graphs'" > "$PGDATA/bench_mode.conf"
+
+"$BINDIR/pg_ctl" -D "$PGDATA" -l "$SCRATCH/server.log" -w start >/dev/null
+$PSQL -c "CREATE EXTENSION pg_plsql_graphs"
+$PSQL -f "$BENCHDIR/functions.sql"
+stop_server
+
+if [ -n "$OUTPUT" ]; then
+    exec 3>"$OUTPUT"
+else
+    exec 3>&1
+fi
+echo "mode,workload,clients,tps,avg_latency_ms,p99_latency_ms,lock_waits" >&3
+
+for mode in $MODES; do
+    start_server "$mode"
+
+    for workload in $WORKLOADS; do
+        for clients in $CLIENTS; do
+            log "mode $mode, workload $workload, $clients clients"
+
+            $PSQL -c "TRUNCATE bench_trigger_target"
+            waits_before=$(lock_waits "$mode")
+
+            rundir=$SCRATCH/run
+            rm -rf "$rundir"
+            mkdir "$rundir"
+
+            # pgbench writes its per transaction log to the current directory
+            (cd "$rundir" &&
+             "$BINDIR/pgbench" -n -h "$SOCKDIR" -p "$PORT" \
+                 -c "$clients" -j "$clients" -T "$DURATION" -l \
+                 -f "$BENCHDIR/workloads/$workload.sql" postgres > pgbench.out 2>&1) ||
+                { cat "$rundir/pgbench.out" >&2; exit 1; }
+
+            waits_after=$(lock_waits "$mode")
+            if [ -n "$waits_before" ]; then
+                waits=$((waits_after - waits_before))
+            else
+                waits=""
+            fi
+
+            # the last tps line excludes the connection setup
+            tps=$(awk '/^tps = / { tps = $3 } END { print tps }' "$rundir/pgbench.out")
+
+            # the third field of the transaction log is the latency in us
+            latency=$(cat "$rundir"/pgbench_log.* | awk '{ print $3 }' | sort -n |
+                awk '{ l[NR] = $1; sum += $1 }
+                     END {
+                         if (NR == 0) { print ","; exit }
+                         i = int(NR * 0.99); if (i < NR * 0.99) i++; if (i < 1) i = 1
+                         printf "%.3f,%.3f\n", sum / NR / 1000, l[i] / 1000
+                     }')
+
+            echo "$mode,$workload,$clients,$tps,$latency,$waits" >&3
+        done
+    done
+
+    stop_server
+done
@@ -0,0 +1 @@
+SELECT bench_large(7);
@@ -0,0 +1 @@
+SELECT bench_loop(100);
@@ -0,0 +1 @@
+SELECT bench_tiny(42);
@@ -0,0 +1 @@
+INSERT INTO bench_trigger_target(v) VALUES (42);
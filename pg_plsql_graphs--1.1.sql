@@ -0,0 +1,271 @@
+/* contrib/pg_plsql_graphs/pg_plsql_graphs--1.1.sql */
+
+-- complain if script is sourced in psql, rather than via CREATE EXTENSION
+\echo Use "CREATE EXTENSION pg_plsql_graphs" to load this file. \quit
+
+
+
+-- Register the C function.
+CREATE FUNCTION pg_plsql_graphs(
+    OUT function_name text,
+    OUT flow_graph_dot text,
+    OUT program_dependence_graph_dot text,
+    OUT graph_id bigint,
+    OUT calls bigint,
+    OUT first_seen timestamptz,
+    OUT last_seen timestamptz,
+    OUT userids oid[],
+    OUT dbids oid[],
+    OUT stored_bytes bigint,
+    OUT compression_ratio double precision,
+    OUT build_memory bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs'
+LANGUAGE C STRICT;
+
+
+-- Register the C function returning the dot of every graph in one line.
+CREATE FUNCTION pg_plsql_graphs_compact(
+    OUT function_name text,
+    OUT flow_graph_dot text,
+    OUT program_dependence_graph_dot text,
+    OUT graph_id bigint,
+    OUT calls bigint,
+    OUT first_seen timestamptz,
+    OUT last_seen timestamptz,
+    OUT userids oid[],
+    OUT dbids oid[],
+    OUT stored_bytes bigint,
+    OUT compression_ratio double precision,
+    OUT build_memory bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_compact'
+LANGUAGE C STRICT;
+
+
+-- Return the graphs of a single function of the current database.
+CREATE FUNCTION pg_plsql_graphs(
+    function regprocedure,
+    OUT function_name text,
+    OUT flow_graph_dot text,
+    OUT program_dependence_graph_dot text,
+    OUT graph_id bigint,
+    OUT calls bigint,
+    OUT first_seen timestamptz,
+    OUT last_seen timestamptz,
+    OUT userids oid[],
+    OUT dbids oid[],
+    OUT stored_bytes bigint,
+    OUT compression_ratio double precision,
+    OUT build_memory bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_by_function'
+LANGUAGE C STRICT;
+
+
+-- Return the graphs called in a database, by a user, of functions whose
+-- name matches a LIKE pattern or called since a point in time.
+-- NULL arguments do not filter.
+CREATE FUNCTION pg_plsql_graphs_filtered(
+    database oid DEFAULT NULL,
+    userid oid DEFAULT NULL,
+    name_pattern text DEFAULT NULL,
+    since timestamptz DEFAULT NULL,
+    OUT function_name text,
+    OUT flow_graph_dot text,
+    OUT program_dependence_graph_dot text,
+    OUT graph_id bigint,
+    OUT calls bigint,
+    OUT first_seen timestamptz,
+    OUT last_seen timestamptz,
+    OUT userids oid[],
+    OUT dbids oid[],
+    OUT stored_bytes bigint,
+    OUT compression_ratio double precision,
+    OUT build_memory bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_filtered'
+LANGUAGE C;
+
+
+-- Render a stored graph to dot with the given edge types.
+CREATE FUNCTION pg_plsql_graph_dot(
+    graph_id bigint,
+    edge_types text[] DEFAULT '{FLOW}',
+    edge_labels boolean DEFAULT true,
+    same_rank boolean DEFAULT false,
+    compact boolean DEFAULT false)
+RETURNS text
+AS 'MODULE_PATHNAME', 'pg_plsql_graph_dot'
+LANGUAGE C STRICT;
+
+
+-- Check whether a node of a stored graph is reachable from another one.
+CREATE FUNCTION pg_plsql_reachable(
+    graph_id bigint,
+    from_node integer,
+    to_node integer)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_plsql_reachable'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION pg_plsql_reachable(
+    function regprocedure,
+    from_stmt integer,
+    to_stmt integer)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'pg_plsql_reachable_by_function'
+LANGUAGE C STRICT;
+
+
+-- List the nodes of a stored graph that read or write a variable.
+CREATE FUNCTION pg_plsql_variable_accesses(
+    graph_id bigint,
+    variable_name text DEFAULT NULL,
+    OUT variable text,
+    OUT dno integer,
+    OUT node integer,
+    OUT access text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_variable_accesses'
+LANGUAGE C;
+
+-- List the nodes of a stored graph with the variables they read and write.
+CREATE FUNCTION pg_plsql_graph_nodes(
+    graph_id bigint,
+    OUT node integer,
+    OUT statement_kind text,
+    OUT lineno integer,
+    OUT label text,
+    OUT read_variables text[],
+    OUT write_variables text[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graph_nodes'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION pg_plsql_graph_nodes(
+    function regprocedure,
+    OUT node integer,
+    OUT statement_kind text,
+    OUT lineno integer,
+    OUT label text,
+    OUT read_variables text[],
+    OUT write_variables text[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graph_nodes_by_function'
+LANGUAGE C STRICT;
+
+-- List the flow and dependence edges of a stored graph.
+CREATE FUNCTION pg_plsql_graph_edges(
+    graph_id bigint,
+    OUT from_node integer,
+    OUT to_node integer,
+    OUT kind text,
+    OUT label text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graph_edges'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION pg_plsql_graph_edges(
+    function regprocedure,
+    OUT from_node integer,
+    OUT to_node integer,
+    OUT kind text,
+    OUT label text)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graph_edges_by_function'
+LANGUAGE C STRICT;
+
+-- Register the lock contention counters of the hash table partitions
+CREATE FUNCTION pg_plsql_graphs_lock_waits(
+    OUT partition integer,
+    OUT waits bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_lock_waits'
+LANGUAGE C;
+
+-- Return the graphs of the latest captured calls, newest first.
+CREATE FUNCTION pg_plsql_recent_graphs(
+    n integer DEFAULT 1,
+    own_backend boolean DEFAULT false,
+    compact boolean DEFAULT false,
+    OUT function_name text,
+    OUT flow_graph_dot text,
+    OUT program_dependence_graph_dot text,
+    OUT graph_id bigint,
+    OUT pid integer,
+    OUT called timestamptz)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_recent_graphs'
+LANGUAGE C STRICT;
+
+-- Return the activity counters of the extension.
+CREATE FUNCTION pg_plsql_graphs_stats(
+    OUT captures bigint,
+    OUT cache_hits bigint,
+    OUT evictions bigint,
+    OUT bytes_stored bigint,
+    OUT truncated bigint,
+    OUT unsupported_statements bigint,
+    OUT lock_waits bigint,
+    OUT stats_reset timestamptz)
+RETURNS record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_stats'
+LANGUAGE C STRICT;
+
+-- Return the latency histograms of building, storing and rendering graphs.
+CREATE FUNCTION pg_plsql_graphs_stage_latency(
+    OUT stage text,
+    OUT calls bigint,
+    OUT total_time double precision,
+    OUT histogram bigint[])
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_stage_latency'
+LANGUAGE C STRICT;
+
+-- Reset the activity counters and the latency histograms.
+CREATE FUNCTION pg_plsql_graphs_stats_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'pg_plsql_graphs_stats_reset'
+LANGUAGE C STRICT;
+
+-- Don't want this to be available to non-superusers.
+REVOKE ALL ON FUNCTION pg_plsql_graphs_stats_reset() FROM PUBLIC;
+
+
+
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_graphs AS
+  SELECT * FROM pg_plsql_graphs();
+
+  
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_graphs_trimmed(function_name, flow_graph_dot, program_dependence_graph_dot) AS
+  SELECT function_name, flow_graph_dot, program_dependence_graph_dot
+  FROM pg_plsql_graphs_compact();
+  
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_last_flowgraph_dot(flow_graph_dot) AS
+  SELECT flow_graph_dot FROM pg_plsql_recent_graphs(1, false, true);
+  
+  
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_last_pdgs_dot(program_dependence_graph_dot) AS
+  SELECT program_dependence_graph_dot FROM pg_plsql_recent_graphs(1, false, true);
+  
+  
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_last_flowgraph_dot_untrimmed(flow_graph_dot) AS
+  SELECT flow_graph_dot FROM pg_plsql_recent_graphs(1);
+  
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_last_pdgs_dot_untrimmed(flow_graph_dot) AS
+  SELECT program_dependence_graph_dot FROM pg_plsql_recent_graphs(1);
+
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_graphs_stats AS
+  SELECT * FROM pg_plsql_graphs_stats();
+
+-- Register a view on the function for ease of use.
+CREATE VIEW pg_plsql_graphs_stage_latency AS
+  SELECT * FROM pg_plsql_graphs_stage_latency();
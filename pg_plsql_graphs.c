@@ -2,14 +2,19 @@
 #include "plpgsql.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
 #include "access/tuptoaster.h"
 #include "access/htup_details.h"
 #include "access/hash.h"
+#include "access/xact.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_language.h"
 #include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "common/pg_lzcompress.h"
 #include "executor/functions.h"
 #include "executor/instrument.h"
 #include "executor/spi.h"
@@ -29,6 +34,8 @@
 #include "parser/scanner.h"
 #include "parser/parse_node.h"
 #include "storage/fd.h"
+#include "port/atomics.h"
+#include "port/pg_crc32c.h"
 #include "storage/ipc.h"
 #include "storage/spin.h"
 #include "pgstat.h"
@@ -39,7 +46,9 @@
 #include "utils/lsyscache.h"
 #include "utils/syscache.h"
 #include "utils/builtins.h"
+#include "utils/array.h"
 #include "utils/memutils.h"
+#include "utils/timestamp.h"
 #include "mb/pg_wchar.h"
 #include "miscadmin.h"
 #include "pg_plsql_graphs.h"
@@ -47,60 +56,363 @@
 PG_MODULE_MAGIC;
 
 
+/* # of partitions of the hash table, must be a power of 2 */
+#define PGPG_NUM_PARTITIONS 16
+
+/* # of slots of the ring of recent captures, must be a power of 2 */
+#define PGPG_RECENT_SIZE 64
+
+/*
+ * A partition of the hash table. The partition of an entry is given by
+ * the hash code of its key, so functions in different partitions are
+ * stored and counted without contention.
+ */
+typedef struct pgpgPartition
+{
+    LWLock*          lock;          /* protects the entries of the partition */
+    pg_atomic_uint64 waits;         /* # of acquisitions of lock that waited */
+    pg_atomic_uint64 hits;          /* # of calls counted on a stored graph */
+} pgpgPartition;
+
+/*
+ * Stages of capturing and reading graphs whose latency is recorded
+ */
+typedef enum pgpgStage
+{
+    PGPG_STAGE_BUILD,               /* building the flow graph */
+    PGPG_STAGE_DEPENDENCES,         /* adding the dependence edges */
+    PGPG_STAGE_RENDER,              /* rendering dot */
+    PGPG_STAGE_STORE,               /* inserting into the hash table */
+    PGPG_NUM_STAGES
+} pgpgStage;
+
+static const char* const pgpgStageNames[PGPG_NUM_STAGES] = {
+    "build",
+    "dependences",
+    "render",
+    "store"
+};
+
+/*
+ * # of latency buckets. Bucket 0 counts durations below 1us, bucket b
+ * those of [2^(b-1), 2^b) us and the last bucket all longer ones.
+ */
+#define PGPG_LATENCY_BUCKETS 24
+
+typedef struct pgpgLatency
+{
+    pg_atomic_uint64 calls;         /* # of recorded durations */
+    pg_atomic_uint64 total_us;      /* sum of the durations in us */
+    pg_atomic_uint64 buckets[PGPG_LATENCY_BUCKETS]; /* histogram */
+} pgpgLatency;
+
+/*
+ * Counters of what the extension does. They are only added to, with
+ * atomics, so no lock is needed. Cache hits and lock waits are counted
+ * per partition instead, as they happen on every call.
+ */
+typedef struct pgpgStats
+{
+    pg_atomic_uint64 captures;      /* # of graphs built and stored */
+    pg_atomic_uint64 evictions;     /* # of entries evicted */
+    pg_atomic_uint64 bytes_stored;  /* bytes of images stored */
+    pg_atomic_uint64 truncated;     /* # of graphs too large to be stored */
+    pg_atomic_uint64 unsupported;   /* # of statements left out of graphs */
+    pgpgLatency      latency[PGPG_NUM_STAGES]; /* per stage */
+} pgpgStats;
+
 /*
- * Shared state
+ * Shared state. Scans of the whole hash table, eviction and compaction of
+ * the storage hold the locks of all partitions, always acquired in order.
  */
 typedef struct pgpgSharedState
 {
-    LWLock*            lock;            /* protects hashtable search/modification */
+    pgpgPartition   partitions[PGPG_NUM_PARTITIONS];
     PLpgSQL_plugin* plugin;            /* PlpgSQL_pluging struct */
+    slock_t     mutex;              /* protects the following fields, unless
+                                     * all partitions are locked exclusively */
     int         counter;            /* counter for ids */
+    Size        storage_used;       /* end of the used part of the graph storage */
+    Size        storage_live;       /* bytes of the storage referenced by entries */
+    pg_atomic_uint32 nindexed;      /* # of functions in the function index */
+    pg_atomic_uint64 recent_head;   /* # of captures published to recent */
+    pgpgRecent  recent[PGPG_RECENT_SIZE]; /* ring of the latest captures */
+    pgpgStats   stats;              /* activity counters */
+    TimestampTz stats_reset;        /* time of the last reset of stats, protected by mutex */
 
 } pgpgSharedState;
 
 
+/* max # of distinct callers (user/database pairs) remembered per entry */
+#define PGPG_MAX_CALLERS 8
+
+/* start value of pgpg_hash_bytes (FNV-1a offset basis) */
+#define PGPG_HASH_SEED UINT64CONST(0xcbf29ce484222325)
+
+/* ms after which a request that produced no entry is sent again */
+#define PGPG_REQUEST_TIMEOUT 60000
+
+/* Location of permanent stats file (valid when database is shut down) */
+#define PGPG_DUMP_FILE      "pg_stat/pg_plsql_graphs.stat"
+
+/* Magic number identifying the stats file format */
+static const uint32 PGPG_FILE_HEADER = 0x50475333;    /* "PGS3" */
+
+/* PostgreSQL major version number, changes in which invalidate all entries */
+static const uint32 PGPG_PG_MAJOR_VERSION = PG_VERSION_NUM / 100;
+
+/* usage of a new entry and increment per call */
+#define USAGE_INIT              (1.0)
+#define USAGE_EXEC              (1.0)
+/* decay of the usage of all entries at each eviction */
+#define USAGE_DECREASE_FACTOR   (0.99)
+/* % of the entries evicted at once */
+#define USAGE_DEALLOC_PERCENT   5
+/* % of max entries and storage budget the worker keeps free */
+#define USAGE_RESERVE_PERCENT   5
+
+#define PG_PLSQL_VARIABLE_ACCESSES_COLS 4
+#define PG_PLSQL_GRAPH_NODES_COLS 6
+#define PG_PLSQL_GRAPH_EDGES_COLS 4
+#define PG_PLSQL_GRAPHS_LOCK_WAITS_COLS 2
+#define PG_PLSQL_GRAPHS_STATS_COLS 8
+#define PG_PLSQL_GRAPHS_STAGE_LATENCY_COLS 4
+#define PG_PLSQL_RECENT_GRAPHS_COLS 6
+/* # of output columns of pg_plsql_graphs() */
+#define PG_PLSQL_GRAPHS_COLS 12
+
 /*
- * Hashtable key that defines the identity of a hashtable entry.  We separate
- * entries by user, database and a function id. Also every entey has a unique id.
+ * Hashtable key that defines the identity of a hashtable entry.  Entries are
+ * content addressed: the key is a hash of the function source and of its
+ * parameters, so the same function in several databases, repeated anonymous code blocks and every
+ * call of a function share one entry.
  */
 typedef struct pgpgHashKey
+{
+    uint64         sourcehash;      /* 64 bit hash of the source and parameters */
+    int32          sourcelen;       /* length of the hashed source */
+
+} pgpgHashKey;
+
+/*
+ * Entry of the graph id index, maps the id of a graph to the key of its
+ * entry. Ids are not reused, so an entry always belongs to the current
+ * graph of its entry; it is removed together with that graph.
+ */
+typedef struct pgpgIdEntry
+{
+    int64          id;              /* graph id - MUST BE FIRST */
+    pgpgHashKey    entrykey;        /* key of the graph entry */
+} pgpgIdEntry;
+
+/*
+ * Key of the function index, a function of a database
+ */
+typedef struct pgpgFunctionKey
+{
+    Oid            dbid;            /* database OID */
+    Oid            functionid;      /* function OID */
+} pgpgFunctionKey;
+
+/*
+ * Entry of the function index, maps a function to the entry of its latest
+ * published version. The entry may have been evicted meanwhile.
+ */
+typedef struct pgpgFunctionEntry
+{
+    pgpgFunctionKey key;            /* hash key of entry - MUST BE FIRST */
+    pgpgHashKey    entrykey;        /* key of the graph entry */
+} pgpgFunctionEntry;
+
+/*
+ * Filter of pg_plsql_graphs_filtered(), unset fields do not filter
+ */
+typedef struct pgpgFilter
+{
+    Oid            dbid;            /* a caller database */
+    Oid            userid;          /* a caller user */
+    text*          pattern;         /* LIKE pattern of the function name */
+    TimestampTz    since;           /* called at this time or later */
+} pgpgFilter;
+
+/*
+ * A user/database pair that called the function of an entry
+ */
+typedef struct pgpgCaller
 {
     Oid            userid;            /* user OID */
     Oid            dbid;            /* database OID */
+    int            pid;             /* process ID, not kept in the counters */
+} pgpgCaller;
+
+/*
+ * A slot of the ring of recent captures, a seqlock. Writers take a position
+ * with an atomic increment of the ring head, claim the slot by setting the
+ * low bit of seq with a compare-and-swap and publish the position in seq
+ * after the other fields. Readers accept the slot only if seq holds their
+ * position before and after they copied it.
+ */
+typedef struct pgpgRecent
+{
+    pg_atomic_uint64 seq;           /* 2 * (position + 1), odd while written */
+    pgpgHashKey    key;             /* key of the captured entry */
+    pgpgCaller     caller;          /* the calling backend */
+    TimestampTz    called;          /* time of the call */
+} pgpgRecent;
+
+/*
+ * Invocation counters of an entry
+ */
+typedef struct pgpgCounters
+{
+    int64          calls;           /* # of calls of the function */
+    double         usage;           /* usage factor, decays at eviction */
+    TimestampTz    first_seen;      /* time of the first call */
+    TimestampTz    last_seen;       /* time of the latest call */
+    int            ncallers;        /* # of valid entries in callers */
+    pgpgCaller     callers[PGPG_MAX_CALLERS]; /* distinct callers */
+} pgpgCounters;
+
+/*
+ * Backend local key of a function version that was already published
+ * to the shared hash table by this backend.
+ */
+typedef struct pgpgLocalKey
+{
     Oid            functionid;        /* function OID */
-    long        uniqueid;        /* unique ID */
+    TransactionId  fn_xmin;         /* xmin of the pg_proc row */
+    ItemPointerData fn_tid;         /* tid of the pg_proc row */
+} pgpgLocalKey;
 
-} pgpgHashKey;
+/*
+ * Backend local entry, maps a function version to its shared entry
+ */
+typedef struct pgpgLocalEntry
+{
+    pgpgLocalKey   key;             /* hash key of entry - MUST BE FIRST */
+    pgpgHashKey    entrykey;        /* key of the shared entry */
+    bool           pending;         /* graphs are requested from the worker */
+    TimestampTz    requested;       /* time of the request */
+} pgpgLocalEntry;
 
 /*
- * Dot dependency graphs to plpgsql functions
+ * Graph of a plpgsql function. The entry only holds its location, the
+ * payload lives in the graph storage: the function name followed by the
+ * compact GraphImage, which is rendered to dot only when it is read.
  */
-typedef struct DotStruct
+typedef struct GraphStruct
 {
-    int64        id;
-    char        functionName[255];
-    char        flowGraphDot[MAXDOTFILESIZE];
-    char        programDepencenceGraphDot[MAXDOTFILESIZE];
-} DotStruct;
+    int64       id;
+    Size        offset;                 /* offset of the payload in the storage */
+    int32       payloadSize;            /* size of the payload, MAXALIGNed */
+    int32       nameLen;                /* length of the function name */
+    int32       imageSize;              /* size of the image, 0 if truncated */
+    int32       storedSize;             /* size of the image as stored */
+    int64       buildMemory;            /* memory used to build the graph */
+    bool        compressed;             /* the image is stored pglz compressed */
+    bool        truncated;              /* image did not fit in the storage */
+} GraphStruct;
+
+/* parts of the payload of an entry, caller must hold its partition lock */
+#define entry_function_name(entry) \
+    (pgpg_storage + (entry)->graph.offset)
+#define entry_image_data(entry) \
+    (pgpg_storage + (entry)->graph.offset + MAXALIGN((entry)->graph.nameLen + 1))
 
 
 
 /*
- * Statistics per statement
+ * Statistics per statement. Only this small header is kept in the hash
+ * table, so scans of the entries do not touch the payloads.
  */
 typedef struct pgpgEntry
 {
     pgpgHashKey key;            /* hash key of entry - MUST BE FIRST */
-    DotStruct    dotStruct;        /* the dotfiles for this function */
-    slock_t        mutex;            /* protects the dotStruct only */
+    pgpgCounters counters;      /* the invocation counters */
+    GraphStruct  graph;            /* the location of the graph of this function */
+    slock_t        mutex;            /* protects the counters only */
 } pgpgEntry;
 
+/*
+ * Header of an entry in the stats file. It is followed by the function
+ * name with its terminating zero, the stored image and the CRC-32C of
+ * all three.
+ */
+typedef struct pgpgFileEntry
+{
+    pgpgHashKey    key;             /* key of the entry */
+    pgpgCounters   counters;        /* the invocation counters */
+    int32          nameLen;         /* length of the function name */
+    int32          imageSize;       /* size of the image, 0 if truncated */
+    int32          storedSize;      /* size of the stored image */
+    int64          buildMemory;     /* memory used to build the graph */
+    bool           compressed;      /* the image is stored pglz compressed */
+    bool           truncated;       /* image did not fit in the storage */
+} pgpgFileEntry;
+
+/*
+ * Backend local copy of an entry. It is taken under the partition lock of
+ * the entry, decompressing and rendering the image happen after the lock
+ * is released.
+ */
+typedef struct pgpgSnapshot
+{
+    pgpgHashKey    key;             /* key of the entry */
+    pgpgCounters   counters;        /* the invocation counters */
+    GraphStruct    graph;           /* the graph, its offset is meaningless */
+    char*          functionName;    /* copy of the function name */
+    char*          storedData;      /* copy of the stored image, NULL if truncated */
+} pgpgSnapshot;
+
+/*
+ * State of a pg_plsql_graph_nodes scan, the variables read and written
+ * per node are collected from the variable array of the image once
+ */
+typedef struct pgpgNodeScan
+{
+    GraphImage*    image;           /* the graph */
+    List**         reads;           /* names of the variables read per node */
+    List**         writes;          /* names of the variables written per node */
+} pgpgNodeScan;
+
+/*
+ * Reachability closure of the graph pg_plsql_reachable() was asked about
+ * last in this backend. Graph ids are not reused, so the closure is valid
+ * as long as a graph with its id is stored.
+ */
+typedef struct pgpgReachCache
+{
+    int64               graphId;    /* id of the graph, -1 if none */
+    int                 nnodes;     /* # of nodes of the graph */
+    int32*              linenos;    /* line number of the statement per node */
+    GraphReachability*  reach;      /* closure over the flow edges */
+} pgpgReachCache;
+
 
 Datum        pg_plsql_graphs(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graph_dot(PG_FUNCTION_ARGS);
+Datum        pg_plsql_reachable(PG_FUNCTION_ARGS);
+Datum        pg_plsql_reachable_by_function(PG_FUNCTION_ARGS);
+Datum        pg_plsql_variable_accesses(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_lock_waits(PG_FUNCTION_ARGS);
+Datum        pg_plsql_recent_graphs(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_by_function(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_filtered(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_compact(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graph_nodes(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graph_nodes_by_function(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graph_edges(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graph_edges_by_function(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_stats(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_stage_latency(PG_FUNCTION_ARGS);
+Datum        pg_plsql_graphs_stats_reset(PG_FUNCTION_ARGS);
 void        _PG_init(void);
 void        _PG_fini(void);
 
 static void pgpg_shmem_startup(void);
+static void pgpg_shmem_shutdown(int code, Datum arg);
+static void pgpg_load(void);
+static void pgpg_save(void);
 static void pgpg_func_beg(PLpgSQL_execstate*    estate,
                           PLpgSQL_function*     func);
 static void pgpg_func_end(PLpgSQL_execstate*    estate,
@@ -110,25 +422,159 @@ static uint32 pgpg_hash_fn(const void*     key,
 static int    pgpg_match_fn(const void*    key1,
                             const void*    key2,
                             Size keysize);
-
-static pgpgEntry * entry_alloc( pgpgHashKey*    key,
-                                bool            sticky,
-                                int             id,
-                                char*           functionName,
-                                char*           flowGraphDot,
-                                char*           programDepencenceGraphDot);
+static uint32 pgpg_id_hash_fn(const void*  key,
+                              Size         keysize);
+
+static uint32 pgpg_hash_key(const pgpgHashKey* key);
+static pgpgPartition* pgpg_partition(uint32 hashcode);
+static void pgpg_lock(pgpgPartition* partition, LWLockMode mode);
+static void pgpg_lock_all(LWLockMode mode);
+static void pgpg_unlock_all(void);
+static void stats_init(void);
+static void stats_clear(void);
+static void stats_time(pgpgStage stage, instr_time start);
+static uint64 pgpg_hash_bytes(uint64          hash,
+                              const char*     data,
+                              int             len);
+static uint64 pgpg_hash_proc_attr(uint64          hash,
+                                  HeapTuple       procTup,
+                                  AttrNumber      attnum);
+static bool make_source_key(pgpgHashKey*       key,
+                            PLpgSQL_function*  function);
+static void make_local_key(pgpgLocalKey*      key,
+                           PLpgSQL_function*  function);
+static pgpgLocalEntry* local_version_lookup(PLpgSQL_function* function);
+static pgpgLocalEntry* local_version_set_published(PLpgSQL_function* function,
+                                                   pgpgHashKey*      entrykey);
+static void request_graph(PLpgSQL_function* function);
+static void store_graph(PLpgSQL_function*  function,
+                        PLpgSQL_execstate* estate,
+                        pgpgHashKey*       key,
+                        bool               hasSource,
+                        bool               rebuild,
+                        pgpgCaller*        caller,
+                        TimestampTz        called);
+static bool entry_count_call(pgpgHashKey* key,
+                             pgpgCaller*  caller,
+                             TimestampTz  called);
+static void entry_record_call(pgpgEntry*   entry,
+                              pgpgCaller*  caller,
+                              TimestampTz  called);
+static void recent_publish(pgpgHashKey* key,
+                           pgpgCaller*  caller,
+                           TimestampTz  called);
+static bool recent_read(uint64 pos, pgpgRecent* recent);
+static bool entry_copy_by_key(pgpgHashKey*  key,
+                              char**        functionName,
+                              GraphImage**  image,
+                              int64*        graphId);
+static bool entry_alloc(pgpgHashKey*    key,
+                        bool            replace,
+                        char*           functionName,
+                        GraphImage*     image,
+                        char*           storedData,
+                        int32           storedSize,
+                        int64           buildMemory,
+                        pgpgCaller*     caller,
+                        TimestampTz     called);
+static void entry_fill(pgpgEntry*      entry,
+                       bool            found,
+                       Size            offset,
+                       Size            payloadSize,
+                       bool            truncated,
+                       char*           functionName,
+                       GraphImage*     image,
+                       char*           storedData,
+                       int32           storedSize,
+                       int64           buildMemory);
+static char* compress_image(GraphImage* image, int32* storedSize);
+static void build_memory_count(MemoryContext context, MemoryContextCounters* totals);
+static void build_memory_sample(MemoryContext context, int64* peak);
+static void entry_snapshot(pgpgEntry* entry, pgpgSnapshot* snapshot);
+static GraphImage* snapshot_image(pgpgSnapshot* snapshot);
+static void snapshot_free(pgpgSnapshot* snapshot);
+static GraphImage* entry_find_image(int64 graphId);
+static bool entry_find_graph_id(pgpgHashKey* key, int64* graphId);
+static bool id_index_contains(int64 graphId);
+static pgpgReachCache* reach_cache_get(int64 graphId);
+static void memo_seed_previous(PLpgSQL_function* function);
+static int64 graph_id_make(uint64 seq, pgpgHashKey* key);
+static void id_index_set(pgpgEntry* entry);
+static void id_index_remove(pgpgEntry* entry);
+static GraphImage* graph_image_arg(FunctionCallInfo fcinfo, bool byFunction);
 static void entry_dealloc(void);
+static bool index_reserve_slot(void);
+static pgpgFunctionEntry* index_enter(pgpgFunctionKey* fkey, uint32 hashcode);
+static void index_set(Oid dbid, Oid functionid, pgpgHashKey* key);
+static bool index_lookup(Oid dbid, Oid functionid, pgpgHashKey* key);
+static void index_prune(void);
+static void entry_copy_counters(pgpgEntry* entry, pgpgCounters* counters);
+static bool entry_matches(pgpgEntry*   entry,
+                          pgpgCounters* counters,
+                          pgpgFilter*  filter);
+static void graphs_put_snapshot(Tuplestorestate* tupstore,
+                                TupleDesc        tupdesc,
+                                pgpgSnapshot*    snapshot,
+                                bool             compact);
+static Tuplestorestate* graphs_begin(FunctionCallInfo fcinfo, TupleDesc* tupdesc);
+static void graphs_scan(Tuplestorestate* tupstore,
+                        TupleDesc        tupdesc,
+                        pgpgFilter*      filter,
+                        bool             compact);
+static int  entry_cmp(const void* lhs, const void* rhs);
+static void entry_remove(pgpgEntry* entry);
+static Size storage_size(void);
+static Size storage_budget(void);
+static bool storage_reserve(Size size, Size* offset);
+static bool storage_alloc(Size size, Size* offset);
+static void storage_gc(void);
+static int  storage_offset_cmp(const void* a, const void* b);
 
 
 /* Saved hook values in case of unload */
 static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
+/*
+ * Capture modes of the func_end hook
+ */
+typedef enum
+{
+    PGPG_CAPTURE_OFF,                /* capture nothing */
+    PGPG_CAPTURE_FIRST_PER_VERSION,  /* build graphs once per function version */
+    PGPG_CAPTURE_SAMPLED,            /* like first-per-version for sampled calls */
+    PGPG_CAPTURE_ALL                 /* rebuild the graphs on every call */
+} PGPGCaptureMode;
+
+static const struct config_enum_entry capture_options[] =
+{
+    {"off", PGPG_CAPTURE_OFF, false},
+    {"first-per-version", PGPG_CAPTURE_FIRST_PER_VERSION, false},
+    {"sampled", PGPG_CAPTURE_SAMPLED, false},
+    {"all", PGPG_CAPTURE_ALL, false},
+    {NULL, 0, false}
+};
+
 static int    pgpg_max = 5000;            /* max # statements to track */
+static int    pgpg_max_storage = 65536;   /* size of the graph storage in kB */
+static int    pgpg_storage_budget = -1;   /* usable part of it in kB, -1 for all */
+static int    pgpg_capture = PGPG_CAPTURE_FIRST_PER_VERSION; /* capture mode */
+static double pgpg_sample_rate = 0.01;   /* fraction of sampled calls */
+static bool   pgpg_save_graphs = true;    /* whether to save graphs across shutdown */
 
 
 /* Links to shared memory state */
 static pgpgSharedState* pgpg = NULL;
 static HTAB* pgpg_hash = NULL;
+static HTAB* pgpg_function_index = NULL;
+static HTAB* pgpg_id_index = NULL;
+static char* pgpg_storage = NULL;
+
+/* Function versions this backend already published, see local_version_published */
+static HTAB* pgpg_local_hash = NULL;
+
+/* Closure of the graph last asked about by pg_plsql_reachable() */
+static MemoryContext pgpg_reach_context = NULL;
+static pgpgReachCache pgpg_reach_cache = {-1, 0, NULL, NULL};
 
 /*
  * Module load callback
@@ -156,13 +602,109 @@ _PG_init(void)
                             NULL,
                             NULL);
 
+    DefineCustomIntVariable("pg_plsql_graphs.max_storage",
+      "Sets the size of the shared memory reserved for the stored graphs.",
+                            NULL,
+                            &pgpg_max_storage,
+                            65536,
+                            1024,
+                            INT_MAX / 1024,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_plsql_graphs.storage_budget",
+      "Sets how much of pg_plsql_graphs.max_storage the stored graphs may use.",
+                            "-1 uses all of it. Graphs beyond the budget are evicted.",
+                            &pgpg_storage_budget,
+                            -1,
+                            -1,
+                            INT_MAX / 1024,
+                            PGC_SIGHUP,
+                            GUC_UNIT_KB,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomEnumVariable("pg_plsql_graphs.capture",
+      "Selects which calls of PL/pgSQL functions are captured by pg_plsql_graphs.",
+                             NULL,
+                             &pgpg_capture,
+                             PGPG_CAPTURE_FIRST_PER_VERSION,
+                             capture_options,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomRealVariable("pg_plsql_graphs.sample_rate",
+      "Fraction of calls that are captured if pg_plsql_graphs.capture is sampled.",
+                             NULL,
+                             &pgpg_sample_rate,
+                             0.01,
+                             0.0,
+                             1.0,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    DefineCustomIntVariable("pg_plsql_graphs.max_workers",
+      "Sets the maximum number of background workers building graphs.",
+                            "There is at most one worker per database.",
+                            &pgpg_max_workers,
+                            2,
+                            1,
+                            64,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomIntVariable("pg_plsql_graphs.queue_size",
+      "Sets the maximum number of functions waiting for a background worker.",
+                            "Further functions are dropped and requested again later.",
+                            &pgpg_queue_size,
+                            256,
+                            16,
+                            65536,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+
+    DefineCustomBoolVariable("pg_plsql_graphs.save",
+      "Save pg_plsql_graphs graphs across server shutdowns.",
+                             NULL,
+                             &pgpg_save_graphs,
+                             true,
+                             PGC_SIGHUP,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+
+    EmitWarningsOnPlaceholders("pg_plsql_graphs");
 
 
     RequestAddinShmemSpace( sizeof(PLpgSQL_plugin)+
                             sizeof(pgpgSharedState)+
                             hash_estimate_size(pgpg_max,
-                                               sizeof(pgpgEntry)));
-    RequestAddinLWLocks(1);
+                                               sizeof(pgpgEntry))+
+                            hash_estimate_size(pgpg_max,
+                                               sizeof(pgpgFunctionEntry))+
+                            hash_estimate_size(pgpg_max,
+                                               sizeof(pgpgIdEntry))+
+                            storage_size()+
+                            pgpg_worker_shmem_size());
+    /* one lock per partition of the hash table, one for the request queue */
+    RequestAddinLWLocks(PGPG_NUM_PARTITIONS + 1);
 
 
 
@@ -188,6 +730,7 @@ _PG_fini(void)
  */
 static void pgpg_shmem_startup(){
     bool        found;
+    bool        initialize;
     HASHCTL        info;
 
 
@@ -206,6 +749,7 @@ static void pgpg_shmem_startup(){
     pgpg = ShmemInitStruct("pgpgSharedState",
                sizeof(pgpgSharedState),
                &found);
+    initialize = !found;
 
     if(!found){
 
@@ -216,7 +760,20 @@ static void pgpg_shmem_startup(){
                    sizeof(PLpgSQL_plugin),
                    &found);
 
-        pgpg->lock = LWLockAssign();
+        for(int p=0;p<PGPG_NUM_PARTITIONS;p++){
+            pgpg->partitions[p].lock = LWLockAssign();
+            pg_atomic_init_u64(&pgpg->partitions[p].waits, 0);
+            pg_atomic_init_u64(&pgpg->partitions[p].hits, 0);
+        }
+        pg_atomic_init_u32(&pgpg->nindexed, 0);
+        pg_atomic_init_u64(&pgpg->recent_head, 0);
+        for(int r=0;r<PGPG_RECENT_SIZE;r++)
+            pg_atomic_init_u64(&pgpg->recent[r].seq, 0);
+        SpinLockInit(&pgpg->mutex);
+        pgpg->counter = 0;
+        pgpg->storage_used = 0;
+        pgpg->storage_live = 0;
+        stats_init();
 
         /**
          * Set a function hook before the execution of PL/SQL function
@@ -245,14 +802,62 @@ static void pgpg_shmem_startup(){
     info.entrysize = sizeof(pgpgEntry);
     info.hash = pgpg_hash_fn;
     info.match = pgpg_match_fn;
+    info.num_partitions = PGPG_NUM_PARTITIONS;
     pgpg_hash = ShmemInitHash("pg_plsql_graph hash",
                               pgpg_max,
                               pgpg_max,
                               &info,
-                              HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+                              HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+                              HASH_PARTITION);
+
+    /* add the index from functions to entries, it uses the same partition locks */
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(pgpgFunctionKey);
+    info.entrysize = sizeof(pgpgFunctionEntry);
+    info.num_partitions = PGPG_NUM_PARTITIONS;
+    pgpg_function_index = ShmemInitHash("pg_plsql_graph function index",
+                                        pgpg_max,
+                                        pgpg_max,
+                                        &info,
+                                        HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+
+    /* add the index from graph ids to entries, guarded by the locks of the entries */
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(int64);
+    info.entrysize = sizeof(pgpgIdEntry);
+    info.hash = pgpg_id_hash_fn;
+    info.num_partitions = PGPG_NUM_PARTITIONS;
+    pgpg_id_index = ShmemInitHash("pg_plsql_graph id index",
+                                  pgpg_max,
+                                  pgpg_max,
+                                  &info,
+                                  HASH_ELEM | HASH_FUNCTION | HASH_PARTITION);
+
+    /* add the storage of the graph payloads */
+    pgpg_storage = ShmemInitStruct("pg_plsql_graph storage",
+                                   storage_size(),
+                                   &found);
+
+    /* add the request queue of the background workers */
+    pgpg_worker_shmem_startup();
+
     /* Release the lock */
     LWLockRelease(AddinShmemInitLock);
 
+    /*
+     * If we're in the postmaster (or a standalone backend...), set up a shmem
+     * exit hook to dump the graphs to disk.
+     */
+    if (!IsUnderPostmaster)
+        on_shmem_exit(pgpg_shmem_shutdown, (Datum) 0);
+
+    /*
+     * Done if some other process already completed our initialization,
+     * otherwise load the graphs saved at the last shutdown.
+     */
+    if (initialize)
+        pgpg_load();
+
 
 }
 
@@ -267,187 +872,371 @@ static void pgpg_func_beg(PLpgSQL_execstate *estate, PLpgSQL_function *func){
  * Function hook after the execution of function
  */
 static void pgpg_func_end(PLpgSQL_execstate *estate, PLpgSQL_function *func){
-    /* creates a graph for the current function */
-    createGraph(func,estate);
+
+    pgpgLocalEntry* local;
+
+    /* capture is switched off */
+    if(pgpg_capture == PGPG_CAPTURE_OFF)
+        return;
+
+    /* only a fraction of the calls is looked at in sampled mode */
+    if(pgpg_capture == PGPG_CAPTURE_SAMPLED &&
+       random() >= pgpg_sample_rate * ((double) MAX_RANDOM_VALUE + 1))
+        return;
+
+    /*
+     * Every call rebuilds the graphs in all mode. Anonymous code blocks
+     * have no catalog entry the worker could compile, they are captured
+     * right here as well.
+     */
+    if(pgpg_capture == PGPG_CAPTURE_ALL || !OidIsValid(func->fn_oid)){
+        createGraph(func,estate,pgpg_capture == PGPG_CAPTURE_ALL);
+        return;
+    }
+
+    local = local_version_lookup(func);
+    if(local){
+        /*
+         * Graphs of this function version are published, only count the
+         * call. If the entry was evicted in the meantime request it again.
+         */
+        if(entry_count_call(&local->entrykey,NULL,0))
+            return;
+
+        /* the worker has not finished the requested graphs yet */
+        if(local->pending &&
+           !TimestampDifferenceExceeds(local->requested,
+                                       GetCurrentStatementStartTimestamp(),
+                                       PGPG_REQUEST_TIMEOUT))
+            return;
+    }
+
+    /* let the background worker build the graphs of the current function */
+    request_graph(func);
 }
 
 /**
- * Creates the graph and stores it in the HashTable
+ * Requests the graphs of the given function version from the background
+ * worker, unless the same source is stored already
  */
-void createGraph(PLpgSQL_function* function,PLpgSQL_execstate *estate){
+static void request_graph(PLpgSQL_function* function){
+    pgpgHashKey     key;
+    pgpgLocalEntry* local;
 
-    /* convert the statements to an flow-graph */
-    igraph_t* igraph = createFlowGraph(function->datums,function->ndatums,function,estate);
+    if(!make_source_key(&key,function))
+        return;
 
-    /* perform depenence analysis operations on igraph */
-    addProgramDependenceEdges(igraph);
+    /*
+     * The same source may have been published already, by another backend
+     * or in another database. In that case only the call is counted.
+     */
+    if(entry_count_call(&key,NULL,0)){
+        local_version_set_published(function,&key);
+        return;
+    }
 
+    /* on a full queue the request is dropped and repeated on a later call */
+    if(pgpg_worker_enqueue(function->fn_oid,function->fn_xmin,&function->fn_tid)){
+        local = local_version_set_published(function,&key);
+        local->pending = true;
+        local->requested = GetCurrentStatementStartTimestamp();
+    }
+}
 
-    //iterateIGraphNodes(igraph,&printReadsAndWrites,NULL,NULL,0);
+/**
+ * 64 bit FNV-1a hash of a byte sequence, continues the given hash value
+ */
+static uint64 pgpg_hash_bytes(uint64 hash, const char* data, int len){
+    for(int i=0;i<len;i++){
+        hash ^= (unsigned char) data[i];
+        hash *= UINT64CONST(0x100000001b3);
+    }
+    return hash;
+}
 
-    /* Create the flow graph */
-    char* flowGraphDot = convertGraphToDotFormat(
-                                igraph,
-                                /* Flow graph has only the FLOW edges with the color black */
-                                list_make1(
-                                list_make2("FLOW", "black")),
-                                1,/* edge labels */
-                                0,/* not on same level */
-                                NULL,/* no additional general atrribs */
-                                "[shape=box]",/* box shape */
-                                MAXDOTFILESIZE);
+/**
+ * Continues the given hash with the bytes of a possibly null varlena
+ * attribute of a pg_proc tuple
+ */
+static uint64 pgpg_hash_proc_attr(uint64 hash, HeapTuple procTup, AttrNumber attnum){
+    Datum   datum;
+    bool    isnull;
 
+    datum = SysCacheGetAttr(PROCOID, procTup, attnum, &isnull);
+    if(isnull)
+        return pgpg_hash_bytes(hash, "", 1);
 
-    char* programDepenceGraphDot = convertGraphToDotFormat(
-                                igraph,
-                                /* Dependence Graph edges with colors, Flow edges are dashed */
-                                list_make4(
-                                        list_make3("FLOW",         "black", "[style=dashed]"),
-                                        list_make2("RW-DEPENDENCE","blue"),
-                                        list_make2("WR-DEPENDENCE","green"),
-                                        list_make2("WW-DEPENDENCE","red")),
-                                0,/* no edge labels */
-                                1,/* on same level */
-                                "splines=ortho;\n",/* ortho */
-                                NULL,/* no additional node attribs */
-                                MAXDOTFILESIZE);
+    struct varlena* value = PG_DETOAST_DATUM_PACKED(datum);
 
+    hash = pgpg_hash_bytes(hash, VARDATA_ANY(value), VARSIZE_ANY_EXHDR(value));
 
+    if((Pointer) value != DatumGetPointer(datum))
+        pfree(value);
 
-    /* destroy the igraph */
-    igraph_destroy(igraph);
-    pfree(igraph);
+    return hash;
+}
 
-    pgpgHashKey key;
+/**
+ * Sets up the content addressed key of a function from its source and its
+ * parameters in pg_proc. The names and types of the parameters are part of
+ * the key, the same body declares other variables under other parameters.
+ * Returns false if there is no source, e.g. for anonymous blocks.
+ */
+static bool make_source_key(pgpgHashKey* key, PLpgSQL_function* function){
+    HeapTuple   procTup;
+    Form_pg_proc procStruct;
+    Datum       prosrcDatum;
+    bool        isnull;
+
+    memset(key, 0, sizeof(pgpgHashKey));
+
+    if(!OidIsValid(function->fn_oid))
+        return false;
+
+    procTup = SearchSysCache1(PROCOID, ObjectIdGetDatum(function->fn_oid));
+    if(!HeapTupleIsValid(procTup))
+        return false;
+    procStruct = (Form_pg_proc) GETSTRUCT(procTup);
+
+    prosrcDatum = SysCacheGetAttr(PROCOID, procTup, Anum_pg_proc_prosrc, &isnull);
+    if(!isnull){
+        text* prosrc = DatumGetTextPP(prosrcDatum);
+        uint64 hash;
+
+        key->sourcelen = VARSIZE_ANY_EXHDR(prosrc);
+        hash = pgpg_hash_bytes(PGPG_HASH_SEED,
+                               VARDATA_ANY(prosrc),
+                               key->sourcelen);
+
+        /* input argument types, then all argument types, modes and names */
+        hash = pgpg_hash_bytes(hash,
+                               (char*) procStruct->proargtypes.values,
+                               procStruct->pronargs * sizeof(Oid));
+        hash = pgpg_hash_proc_attr(hash, procTup, Anum_pg_proc_proallargtypes);
+        hash = pgpg_hash_proc_attr(hash, procTup, Anum_pg_proc_proargmodes);
+        hash = pgpg_hash_proc_attr(hash, procTup, Anum_pg_proc_proargnames);
+        key->sourcehash = hash;
+
+        if((Pointer) prosrc != DatumGetPointer(prosrcDatum))
+            pfree(prosrc);
+    }
 
-    /* Set lock for accessing pgpg variables and the hash table */
-    LWLockAcquire(pgpg->lock, LW_EXCLUSIVE);
+    ReleaseSysCache(procTup);
 
-    /* Set up key for hashtable search */
-    key.userid = GetUserId();
-    key.dbid = MyDatabaseId;
-    key.functionid = function->fn_oid;
-    key.uniqueid = pgpg->counter++;
+    return !isnull;
+}
 
+/**
+ * Fills the backend local key of the given function version
+ */
+static void make_local_key(pgpgLocalKey* key, PLpgSQL_function* function){
+    /* zero the key, it is hashed as a blob including padding */
+    memset(key, 0, sizeof(pgpgLocalKey));
 
-    /* Allocates an entry in the hash table */
-    entry_alloc(    &key,
-                    true,
-                    pgpg->counter,
-                    function->fn_signature,
-                    flowGraphDot,
-                    programDepenceGraphDot);
+    key->functionid = function->fn_oid;
+    key->fn_xmin = function->fn_xmin;
+    key->fn_tid = function->fn_tid;
+}
 
-    /* Release the lock */
-    LWLockRelease(pgpg->lock);
+/**
+ * Returns the local entry if this backend already published the graphs
+ * of the given function version, otherwise NULL. This is the fast path
+ * of every call.
+ */
+static pgpgLocalEntry* local_version_lookup(PLpgSQL_function* function){
+    pgpgLocalKey key;
 
-    /* Dot sources were copied to shared memory so we can free them */
-    pfree(programDepenceGraphDot);
-    pfree(flowGraphDot);
+    if(!pgpg_local_hash)
+        return NULL;
 
+    make_local_key(&key,function);
 
+    return (pgpgLocalEntry*) hash_search(pgpg_local_hash, &key, HASH_FIND, NULL);
 }
 
+/**
+ * Remembers that the graphs of the given function version are published
+ * in the shared entry with the given key
+ */
+static pgpgLocalEntry* local_version_set_published(PLpgSQL_function* function,
+                                                   pgpgHashKey*      entrykey){
+    pgpgLocalKey    key;
+    pgpgLocalEntry* local;
+
+    /* forget everything if old function versions pile up */
+    if(pgpg_local_hash && hash_get_num_entries(pgpg_local_hash) >= pgpg_max){
+        hash_destroy(pgpg_local_hash);
+        pgpg_local_hash = NULL;
+    }
 
+    if(!pgpg_local_hash){
+        HASHCTL info;
+
+        memset(&info, 0, sizeof(info));
+        info.keysize = sizeof(pgpgLocalKey);
+        info.entrysize = sizeof(pgpgLocalEntry);
+        info.hcxt = TopMemoryContext;
+        pgpg_local_hash = hash_create("pg_plsql_graph local hash",
+                                      256,
+                                      &info,
+                                      HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
 
+    make_local_key(&key,function);
+    local = (pgpgLocalEntry*) hash_search(pgpg_local_hash, &key, HASH_ENTER, NULL);
+    local->entrykey = *entrykey;
+    local->pending = false;
+    local->requested = 0;
 
+    /* the function can be looked up by its OID from now on */
+    index_set(MyDatabaseId,function->fn_oid,entrykey);
 
-
-PG_FUNCTION_INFO_V1(pg_plsql_graphs);
+    return local;
+}
 
 /**
- * Custom pg_plsql_graphs function that can be called by the user
- * and will return a table containing graphs of preivous called
- * plpgsql functions.
+ * Creates the graph and stores it in the HashTable. If rebuild is set the
+ * graph is built even if the function source is stored already and replaces
+ * the stored graph.
  */
-Datum pg_plsql_graphs(PG_FUNCTION_ARGS){
+void createGraph(PLpgSQL_function* function,PLpgSQL_execstate *estate,bool rebuild){
 
-    pgpgEntry * entry;
+    pgpgHashKey key;
 
-    /* Info about the return set */
-    ReturnSetInfo*   rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
-    TupleDesc        tupdesc;
-    Tuplestorestate* tupstore;
-    MemoryContext    per_query_ctx;
-    MemoryContext    oldcontext;
-    HASH_SEQ_STATUS  hash_seq;
+    /* Set up key for hashtable search */
+    bool hasSource = make_source_key(&key,function);
 
+    /*
+     * The same source may have been published already, by another backend
+     * or in another database. In that case only the call is counted.
+     */
+    if(hasSource && !rebuild && entry_count_call(&key,NULL,0)){
+        local_version_set_published(function,&key);
+        return;
+    }
 
-    /* hash table must exist already */
-    if (!pgpg || !pgpg_hash)
-        ereport(ERROR,
-                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
-                 errmsg("pg_stat_statements must be loaded via shared_preload_libraries")));
+    store_graph(function,estate,&key,hasSource,rebuild,NULL,0);
 
-    /* check to see if caller supports us returning a tuplestore */
-    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("set-valued function called in context that cannot accept a set")));
-    if (!(rsinfo->allowedModes & SFRM_Materialize))
-        ereport(ERROR,
-                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-                 errmsg("materialize mode required, but it is not " \
-                        "allowed in this context")));
+    /* later calls of this function version only need the local check */
+    if(hasSource)
+        local_version_set_published(function,&key);
+}
 
-    /* Build a tuple descriptor for our result type */
-    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
-        elog(ERROR, "return type must be a row type");
+/**
+ * Creates the graph of a function compiled by the background worker on
+ * behalf of the given caller and stores it in the HashTable
+ */
+void createRequestedGraph(PLpgSQL_function* function,
+                          Oid               userid,
+                          Oid               dbid,
+                          int               pid,
+                          TimestampTz       called){
+    pgpgHashKey key;
+    pgpgCaller  caller;
 
+    caller.userid = userid;
+    caller.dbid = dbid;
+    caller.pid = pid;
 
-    /* Switch into long-lived context to construct returned data structures */
-    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
-    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+    if(!make_source_key(&key,function))
+        return;
 
+    /* several backends may have requested the same source */
+    if(entry_count_call(&key,&caller,called))
+        return;
 
-    /* Init tuplestore to store the return table */
-    tupstore = tuplestore_begin_heap(true, false, work_mem);
-    rsinfo->returnMode = SFRM_Materialize;
-    rsinfo->setResult = tupstore;
-    rsinfo->setDesc = tupdesc;
+    store_graph(function,NULL,&key,true,false,&caller,called);
+}
 
+/**
+ * Builds the graphs of a function, stores them in the entry with the
+ * given key and counts the call of the given caller. Anonymous code blocks
+ * (hasSource not set) get a key from the content of their graphs.
+ */
+static void store_graph(PLpgSQL_function*  function,
+                        PLpgSQL_execstate* estate,
+                        pgpgHashKey*       key,
+                        bool               hasSource,
+                        bool               rebuild,
+                        pgpgCaller*        caller,
+                        TimestampTz        called){
+    char*       storedData;
+    int32       storedSize;
+    int64       buildMemory = 0;
+    instr_time  start;
 
     /*
-     * Get shared lock, load or reload the query text file if we must, and
-     * iterate over the hashtable entries.
+     * Everything allocated while building goes to its own context, which
+     * is deleted once the graph is stored. Capturing many calls in one
+     * transaction does not pile up memory then.
      */
-    LWLockAcquire(pgpg->lock, LW_SHARED);
-
-    /* interate the pgpg_hash */
-    hash_seq_init(&hash_seq, pgpg_hash);
-    while ((entry = hash_seq_search(&hash_seq)) != NULL)
-    {
-        /* values will store the current row  */
-        Datum        values[tupdesc->natts];
-        bool        nulls[tupdesc->natts];
-        int            i = 0;
-        int            j = 0;
+    MemoryContext buildContext = AllocSetContextCreate(CurrentMemoryContext,
+                                                       "pg_plsql_graphs build",
+                                                       ALLOCSET_DEFAULT_MINSIZE,
+                                                       ALLOCSET_DEFAULT_INITSIZE,
+                                                       ALLOCSET_DEFAULT_MAXSIZE);
+    MemoryContext oldcontext = MemoryContextSwitchTo(buildContext);
 
-        memset(values, 0, sizeof(values));
-        memset(nulls, 0, sizeof(nulls));
+    /* statements the previous version had already are not parsed again */
+    if(hasSource && !rebuild)
+        memo_seed_previous(function);
 
-        /* Set columns of the current row */
-        values[i++] = CStringGetTextDatum(entry->dotStruct.functionName);
-        values[i++] = CStringGetTextDatum(entry->dotStruct.flowGraphDot);
-        values[i++] = CStringGetTextDatum(entry->dotStruct.programDepencenceGraphDot);
+    /* convert the statements to an flow-graph */
+    INSTR_TIME_SET_CURRENT(start);
+    PLGraph* graph = createFlowGraph(function->datums,function->ndatums,function,estate);
+    stats_time(PGPG_STAGE_BUILD,start);
+    build_memory_sample(buildContext,&buildMemory);
 
-        /* No null values */
-        nulls[j++] = false;
-        nulls[j++] = false;
-        nulls[j++] = false;
+    /* perform depenence analysis operations on the graph */
+    INSTR_TIME_SET_CURRENT(start);
+    addProgramDependenceEdges(graph);
+    stats_time(PGPG_STAGE_DEPENDENCES,start);
+    build_memory_sample(buildContext,&buildMemory);
 
-        /* put current row in the tuplestore */
-        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
-    }
+    pg_atomic_fetch_add_u64(&pgpg->stats.captures, 1);
+    pg_atomic_fetch_add_u64(&pgpg->stats.unsupported, graph->nunsupported);
 
-    /* Release the lock */
-    LWLockRelease(pgpg->lock);
+    /* Create the compact image, dot is rendered from it when it is read */
+    GraphImage* image = convertGraphToImage(graph);
+    build_memory_sample(buildContext,&buildMemory);
 
-    /* clean up and return the tuplestore */
-    tuplestore_donestoring(tupstore);
+    /* the graph goes with the build context */
 
+    /*
+     * Anonymous code blocks have no source in the catalog, they are
+     * addressed by the content of their graphs instead.
+     */
+    if(!hasSource){
+        key->sourcelen = image->size;
+        key->sourcehash = pgpg_hash_bytes(PGPG_HASH_SEED,
+                                          (char*) image,
+                                          image->size);
+    }
 
-    return (Datum) 0;;
+    /*
+     * The image is stored compressed and decompressed only when it is
+     * read. Compress it before the lock is taken.
+     */
+    storedData = compress_image(image,&storedSize);
+
+    build_memory_sample(buildContext,&buildMemory);
+
+    /* Allocates an entry in the hash table or finds the existing one */
+    INSTR_TIME_SET_CURRENT(start);
+    entry_alloc(key,
+                rebuild,
+                function->fn_signature,
+                image,
+                storedData,
+                storedSize,
+                buildMemory,
+                caller,
+                called);
+    stats_time(PGPG_STAGE_STORE,start);
+
+    /* The image was copied to shared memory, drop everything of the build */
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextDelete(buildContext);
 }
 
 
@@ -456,98 +1245,2536 @@ Datum pg_plsql_graphs(PG_FUNCTION_ARGS){
 
 
 /*
- * Calculate hash value for a key
+ * Builds a row of pg_plsql_graphs() for a snapshot of an entry and puts it
+ * in the tuplestore, with dot in a single line if compact is set. No lock
+ * is needed.
  */
-static uint32
-pgpg_hash_fn(const void *key, Size keysize)
+static void
+graphs_put_snapshot(Tuplestorestate* tupstore, TupleDesc tupdesc,
+                    pgpgSnapshot* snapshot, bool compact)
 {
-    const pgpgHashKey *k = (const pgpgHashKey *) key;
+    /* values will store the current row  */
+    Datum        values[PG_PLSQL_GRAPHS_COLS];
+    bool        nulls[PG_PLSQL_GRAPHS_COLS];
+    Datum        userids[PGPG_MAX_CALLERS];
+    Datum        dbids[PGPG_MAX_CALLERS];
+    pgpgCounters* counters = &snapshot->counters;
+    int            i = 0;
+
+    memset(values, 0, sizeof(values));
+    memset(nulls, 0, sizeof(nulls));
+
+    for(int c=0;c<counters->ncallers;c++){
+        userids[c] = ObjectIdGetDatum(counters->callers[c].userid);
+        dbids[c] = ObjectIdGetDatum(counters->callers[c].dbid);
+    }
+
+    /* Set columns of the current row */
+    values[i++] = CStringGetTextDatum(snapshot->functionName);
+    if(snapshot->graph.truncated){
+        /* too large to be stored */
+        nulls[i++] = true;
+        nulls[i++] = true;
+    }
+    else{
+        /* render the stored image */
+        GraphImage* image = snapshot_image(snapshot);
+        instr_time  start;
+
+        INSTR_TIME_SET_CURRENT(start);
+        values[i++] = CStringGetTextDatum(convertGraphToFlowGraphDot(image,compact));
+        values[i++] = CStringGetTextDatum(convertGraphToProgramDependenceGraphDot(image,compact));
+        stats_time(PGPG_STAGE_RENDER,start);
+        pfree(image);
+    }
+    values[i++] = Int64GetDatumFast(snapshot->graph.id);
+    values[i++] = Int64GetDatumFast(counters->calls);
+    values[i++] = TimestampTzGetDatum(counters->first_seen);
+    values[i++] = TimestampTzGetDatum(counters->last_seen);
+    values[i++] = PointerGetDatum(construct_array(userids, counters->ncallers,
+                                                  OIDOID, sizeof(Oid), true, 'i'));
+    values[i++] = PointerGetDatum(construct_array(dbids, counters->ncallers,
+                                                  OIDOID, sizeof(Oid), true, 'i'));
+    values[i++] = Int64GetDatumFast((int64) snapshot->graph.payloadSize);
+    if(snapshot->graph.truncated)
+        nulls[i++] = true;
+    else
+        values[i++] = Float8GetDatumFast((double) snapshot->graph.imageSize /
+                                         snapshot->graph.storedSize);
+    if(snapshot->graph.buildMemory == 0)
+        nulls[i++] = true;
+    else
+        values[i++] = Int64GetDatumFast(snapshot->graph.buildMemory);
 
-    return hash_uint32((uint32) k->userid) ^
-        hash_uint32((uint32) k->dbid) ^
-        hash_uint32((uint32) k->functionid) ^
-        hash_uint32((uint32) k->uniqueid) ;
+    /* put current row in the tuplestore, 1.0 only reads the first three columns */
+    tuplestore_putvalues(tupstore, tupdesc, values, nulls);
 }
 
+
 /*
- * Compare two keys - zero means match
+ * Copies the counters of an entry, they may be changed concurrently
  */
-static int
-pgpg_match_fn(const void *key1, const void *key2, Size keysize)
+static void
+entry_copy_counters(pgpgEntry* entry, pgpgCounters* counters)
+{
+    volatile pgpgEntry *e = (volatile pgpgEntry *) entry;
+
+    SpinLockAcquire(&e->mutex);
+    *counters = e->counters;
+    SpinLockRelease(&e->mutex);
+}
+
+
+/*
+ * true if the entry passes the filter. Database and user match if they are
+ * among the remembered callers, the pattern is matched like LIKE.
+ */
+static bool
+entry_matches(pgpgEntry* entry, pgpgCounters* counters, pgpgFilter* filter)
+{
+    if(OidIsValid(filter->dbid) || OidIsValid(filter->userid)){
+        int c;
+
+        for(c=0;c<counters->ncallers;c++){
+            if((!OidIsValid(filter->dbid) || counters->callers[c].dbid == filter->dbid) &&
+               (!OidIsValid(filter->userid) || counters->callers[c].userid == filter->userid))
+                break;
+        }
+        if(c == counters->ncallers)
+            return false;
+    }
+
+    if(filter->since != 0 && counters->last_seen < filter->since)
+        return false;
+
+    if(filter->pattern != NULL){
+        text*   name = cstring_to_text(entry_function_name(entry));
+        bool    match = DatumGetBool(DirectFunctionCall2Coll(textlike,
+                                                             DEFAULT_COLLATION_OID,
+                                                             PointerGetDatum(name),
+                                                             PointerGetDatum(filter->pattern)));
+
+        pfree(name);
+        if(!match)
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Checks the call of a pg_plsql_graphs() variant, or another function
+ * returning a materialized set, and sets up the tuplestore of its result
+ */
+static Tuplestorestate *
+graphs_begin(FunctionCallInfo fcinfo, TupleDesc* tupdesc)
+{
+    /* Info about the return set */
+    ReturnSetInfo*   rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+    Tuplestorestate* tupstore;
+    MemoryContext    per_query_ctx;
+    MemoryContext    oldcontext;
+
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    /* check to see if caller supports us returning a tuplestore */
+    if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("set-valued function called in context that cannot accept a set")));
+    if (!(rsinfo->allowedModes & SFRM_Materialize))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("materialize mode required, but it is not " \
+                        "allowed in this context")));
+
+    /* Build a tuple descriptor for our result type */
+    if (get_call_result_type(fcinfo, NULL, tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+
+    /* Switch into long-lived context to construct returned data structures */
+    per_query_ctx = rsinfo->econtext->ecxt_per_query_memory;
+    oldcontext = MemoryContextSwitchTo(per_query_ctx);
+
+
+    /* Init tuplestore to store the return table */
+    tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->returnMode = SFRM_Materialize;
+    rsinfo->setResult = tupstore;
+    rsinfo->setDesc = *tupdesc;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    return tupstore;
+}
+
+
+/*
+ * Puts the rows of all entries passing the filter, if any, in the
+ * tuplestore. The locks of all partitions are only held while the
+ * matching entries are copied, the compressed images are copied as they
+ * are. Rendering and the tuplestore, which may spill to disk, work on the
+ * copies after the locks are released.
+ */
+static void
+graphs_scan(Tuplestorestate* tupstore, TupleDesc tupdesc, pgpgFilter* filter,
+            bool compact)
+{
+    pgpgEntry*       entry;
+    HASH_SEQ_STATUS  hash_seq;
+    pgpgCounters     counters;
+    pgpgSnapshot*    snapshots;
+    int              nsnapshots = 0;
+
+    /*
+     * Get shared locks of all partitions and iterate over the hashtable
+     * entries. Entries are only added with a partition lock held, so the
+     * number of entries does not change meanwhile.
+     */
+    pgpg_lock_all(LW_SHARED);
+
+    snapshots = palloc(Max(hash_get_num_entries(pgpg_hash),1) * sizeof(pgpgSnapshot));
+
+    /* interate the pgpg_hash */
+    hash_seq_init(&hash_seq, pgpg_hash);
+    while ((entry = hash_seq_search(&hash_seq)) != NULL)
+    {
+        entry_copy_counters(entry, &counters);
+        if(filter == NULL || entry_matches(entry, &counters, filter))
+            entry_snapshot(entry, &snapshots[nsnapshots++]);
+    }
+
+    /* Release the locks */
+    pgpg_unlock_all();
+
+    for(int i=0;i<nsnapshots;i++){
+        graphs_put_snapshot(tupstore, tupdesc, &snapshots[i], compact);
+        snapshot_free(&snapshots[i]);
+    }
+
+    pfree(snapshots);
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs);
+
+/**
+ * Custom pg_plsql_graphs function that can be called by the user
+ * and will return a table containing graphs of preivous called
+ * plpgsql functions.
+ */
+Datum pg_plsql_graphs(PG_FUNCTION_ARGS){
+    TupleDesc        tupdesc;
+    Tuplestorestate* tupstore = graphs_begin(fcinfo, &tupdesc);
+
+    graphs_scan(tupstore, tupdesc, NULL, false);
+
+    /* clean up and return the tuplestore */
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_compact);
+
+/**
+ * pg_plsql_graphs with the dot of every graph in a single line, which
+ * pg_plsql_graphs_trimmed shows
+ */
+Datum pg_plsql_graphs_compact(PG_FUNCTION_ARGS){
+    TupleDesc        tupdesc;
+    Tuplestorestate* tupstore = graphs_begin(fcinfo, &tupdesc);
+
+    graphs_scan(tupstore, tupdesc, NULL, true);
+
+    /* clean up and return the tuplestore */
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_by_function);
+
+/**
+ * pg_plsql_graphs for a single function of the current database. The
+ * entry is found through the function index, only its partition is locked.
+ */
+Datum pg_plsql_graphs_by_function(PG_FUNCTION_ARGS){
+    TupleDesc        tupdesc;
+    Tuplestorestate* tupstore = graphs_begin(fcinfo, &tupdesc);
+    pgpgHashKey      key;
+
+    if(index_lookup(MyDatabaseId, PG_GETARG_OID(0), &key)){
+        uint32          hashcode = pgpg_hash_key(&key);
+        pgpgPartition*  partition = pgpg_partition(hashcode);
+        pgpgEntry*      entry;
+        pgpgSnapshot    snapshot;
+
+        pgpg_lock(partition, LW_SHARED);
+
+        entry = (pgpgEntry *) hash_search_with_hash_value(pgpg_hash, &key, hashcode,
+                                                          HASH_FIND, NULL);
+        if(entry)
+            entry_snapshot(entry, &snapshot);
+
+        LWLockRelease(partition->lock);
+
+        if(entry)
+            graphs_put_snapshot(tupstore, tupdesc, &snapshot, false);
+    }
+
+    /* clean up and return the tuplestore */
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_filtered);
+
+/**
+ * pg_plsql_graphs restricted to a database, a user, a function name
+ * pattern and calls since a point in time. NULL arguments do not filter.
+ */
+Datum pg_plsql_graphs_filtered(PG_FUNCTION_ARGS){
+    TupleDesc        tupdesc;
+    Tuplestorestate* tupstore = graphs_begin(fcinfo, &tupdesc);
+    pgpgFilter       filter;
+
+    filter.dbid = PG_ARGISNULL(0) ? InvalidOid : PG_GETARG_OID(0);
+    filter.userid = PG_ARGISNULL(1) ? InvalidOid : PG_GETARG_OID(1);
+    filter.pattern = PG_ARGISNULL(2) ? NULL : PG_GETARG_TEXT_PP(2);
+    filter.since = PG_ARGISNULL(3) ? 0 : PG_GETARG_TIMESTAMPTZ(3);
+
+    graphs_scan(tupstore, tupdesc, &filter, false);
+
+    /* clean up and return the tuplestore */
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graph_dot);
+
+/**
+ * Renders the stored graph with the given id to dot, showing the given
+ * edge types. Returns NULL if there is no such graph.
+ */
+Datum pg_plsql_graph_dot(PG_FUNCTION_ARGS){
+
+    int64       graphId = PG_GETARG_INT64(0);
+    ArrayType*  edgeTypes = PG_GETARG_ARRAYTYPE_P(1);
+    bool        edgeLabels = PG_GETARG_BOOL(2);
+    bool        sameRank = PG_GETARG_BOOL(3);
+    bool        compact = PG_GETARG_BOOL(4);
+    Datum*      elems;
+    bool*       elemNulls;
+    int         nelems;
+    int         edgeKinds = 0;
+    GraphImage* image;
+    instr_time  start;
+    char*       dot;
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    /* collect the requested edge kinds */
+    deconstruct_array(edgeTypes, TEXTOID, -1, false, 'i',
+                      &elems, &elemNulls, &nelems);
+    for(int e=0;e<nelems;e++){
+        char* name;
+        int   kind;
+
+        if(elemNulls[e])
+            continue;
+
+        name = TextDatumGetCString(elems[e]);
+        kind = edgeKindFromName(name);
+        if(kind < 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("unrecognized edge type \"%s\"", name),
+                     errhint("Valid edge types are FLOW, RW-DEPENDENCE, WR-DEPENDENCE and WW-DEPENDENCE.")));
+        edgeKinds |= 1 << kind;
+    }
+
+    image = entry_find_image(graphId);
+    if(image == NULL)
+        PG_RETURN_NULL();
+
+    INSTR_TIME_SET_CURRENT(start);
+    dot = convertGraphToCustomDot(image,edgeKinds,edgeLabels,sameRank,compact);
+    stats_time(PGPG_STAGE_RENDER,start);
+
+    PG_RETURN_TEXT_P(cstring_to_text(dot));
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_reachable);
+
+/**
+ * Returns true if the second node of the stored graph with the given id
+ * can be reached from the first one over flow edges. Returns NULL if
+ * there is no such graph.
+ */
+Datum pg_plsql_reachable(PG_FUNCTION_ARGS){
+
+    int64               graphId = PG_GETARG_INT64(0);
+    int32               from = PG_GETARG_INT32(1);
+    int32               to = PG_GETARG_INT32(2);
+    pgpgReachCache*     cache;
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    cache = reach_cache_get(graphId);
+    if(cache == NULL)
+        PG_RETURN_NULL();
+
+    if(from < 0 || from >= cache->nnodes || to < 0 || to >= cache->nnodes)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("node ids must be between 0 and %d", cache->nnodes - 1)));
+
+    PG_RETURN_BOOL(isReachable(cache->reach,from,to));
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_reachable_by_function);
+
+/**
+ * Returns true if a statement starting at the second line of the given
+ * function of the current database can be reached from a statement
+ * starting at the first line over flow edges. Returns NULL if the graph
+ * of the function is not stored.
+ */
+Datum pg_plsql_reachable_by_function(PG_FUNCTION_ARGS){
+
+    Oid                 functionId = PG_GETARG_OID(0);
+    int32               fromLine = PG_GETARG_INT32(1);
+    int32               toLine = PG_GETARG_INT32(2);
+    pgpgHashKey         key;
+    int64               graphId;
+    pgpgReachCache*     cache;
+    bool                fromFound = false;
+    bool                toFound = false;
+    bool                reachable = false;
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    if(!index_lookup(MyDatabaseId,functionId,&key) ||
+       !entry_find_graph_id(&key,&graphId))
+        PG_RETURN_NULL();
+
+    cache = reach_cache_get(graphId);
+    if(cache == NULL)
+        PG_RETURN_NULL();
+
+    /* several statements may start on a line, node 0 is the entry */
+    for(int from=1;from<cache->nnodes;from++){
+        if(cache->linenos[from] != fromLine)
+            continue;
+        fromFound = true;
+
+        for(int to=1;to<cache->nnodes;to++){
+            if(cache->linenos[to] != toLine)
+                continue;
+            toFound = true;
+
+            if(!reachable && isReachable(cache->reach,from,to))
+                reachable = true;
+        }
+    }
+
+    if(!fromFound || !toFound)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("no statement of function %s starts at line %d",
+                        format_procedure(functionId),
+                        fromFound ? toLine : fromLine)));
+
+    PG_RETURN_BOOL(reachable);
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_variable_accesses);
+
+/**
+ * Lists the nodes of the stored graph with the given id that read or
+ * write a variable, optionally only those of the variable with the
+ * given name
+ */
+Datum pg_plsql_variable_accesses(PG_FUNCTION_ARGS){
+
+    TupleDesc           tupdesc;
+    Tuplestorestate*    tupstore = graphs_begin(fcinfo, &tupdesc);
+    char*               variableName = NULL;
+    GraphImage*         image = NULL;
+
+    if(!PG_ARGISNULL(1))
+        variableName = text_to_cstring(PG_GETARG_TEXT_PP(1));
+    if(!PG_ARGISNULL(0))
+        image = entry_find_image(PG_GETARG_INT64(0));
+
+    /* one row per reading or writing node of a variable */
+    for(int v=0;image != NULL && v<image->nvariables;v++){
+        GraphImageVariable* variable = &GraphImageVariables(image)[v];
+        int32*              accesses = GraphImageAccesses(image) + variable->start;
+        char*               name = GraphImageString(image,variable->name);
+
+        if(variableName != NULL && strcmp(name,variableName) != 0)
+            continue;
+
+        for(int i=0;i<variable->nreaders + variable->nwriters;i++){
+            Datum   values[PG_PLSQL_VARIABLE_ACCESSES_COLS];
+            bool    nulls[PG_PLSQL_VARIABLE_ACCESSES_COLS];
+
+            memset(nulls, 0, sizeof(nulls));
+            values[0] = CStringGetTextDatum(name);
+            values[1] = Int32GetDatum(variable->dno);
+            values[2] = Int32GetDatum(accesses[i]);
+            values[3] = CStringGetTextDatum(i < variable->nreaders ? "READ" : "WRITE");
+
+            tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+        }
+    }
+
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graph_nodes);
+PG_FUNCTION_INFO_V1(pg_plsql_graph_nodes_by_function);
+
+/*
+ * Builds a text array of the given names
+ */
+static Datum
+names_to_array(List* names)
+{
+    Datum*      elems = palloc(Max(list_length(names),1) * sizeof(Datum));
+    ListCell*   lc;
+    int         n = 0;
+
+    foreach(lc, names)
+        elems[n++] = CStringGetTextDatum((char *) lfirst(lc));
+
+    return PointerGetDatum(construct_array(elems, n, TEXTOID, -1, false, 'i'));
+}
+
+/*
+ * Returns the nodes of a stored graph one row per call, so they need not
+ * be parsed from its dot output
+ */
+static Datum
+graph_nodes_internal(FunctionCallInfo fcinfo, bool byFunction)
+{
+    FuncCallContext*    funcctx;
+    pgpgNodeScan*       scan;
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext   oldcontext;
+        TupleDesc       tupdesc;
+        GraphImage*     image;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            elog(ERROR, "return type must be a row type");
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        image = graph_image_arg(fcinfo, byFunction);
+        scan = palloc0(sizeof(pgpgNodeScan));
+        scan->image = image;
+        funcctx->user_fctx = scan;
+        funcctx->max_calls = image ? image->nnodes : 0;
+
+        /* invert the readers and writers of the variables */
+        if (image)
+        {
+            scan->reads = palloc0(Max(image->nnodes,1) * sizeof(List*));
+            scan->writes = palloc0(Max(image->nnodes,1) * sizeof(List*));
+
+            for (int v = 0; v < image->nvariables; v++)
+            {
+                GraphImageVariable* variable = &GraphImageVariables(image)[v];
+                int32*              accesses = GraphImageAccesses(image) + variable->start;
+                char*               name = GraphImageString(image, variable->name);
+
+                for (int i = 0; i < variable->nreaders + variable->nwriters; i++)
+                {
+                    List**  lists = i < variable->nreaders ? scan->reads : scan->writes;
+
+                    if (accesses[i] >= 0 && accesses[i] < image->nnodes)
+                        lists[accesses[i]] = lappend(lists[accesses[i]], name);
+                }
+            }
+        }
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    scan = (pgpgNodeScan *) funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls)
+    {
+        int             nodeid = (int) funcctx->call_cntr;
+        GraphImageNode* node = &GraphImageNodes(scan->image)[nodeid];
+        Datum           values[PG_PLSQL_GRAPH_NODES_COLS];
+        bool            nulls[PG_PLSQL_GRAPH_NODES_COLS];
+        HeapTuple       tuple;
+
+        memset(nulls, 0, sizeof(nulls));
+
+        values[0] = Int32GetDatum(nodeid);
+        /* the entry node has no statement */
+        if (nodeid == 0)
+        {
+            values[1] = CStringGetTextDatum("entry");
+            nulls[2] = true;
+        }
+        else
+        {
+            values[1] = CStringGetTextDatum(stmtKindName(node->stmtKind));
+            values[2] = Int32GetDatum(node->lineno);
+        }
+        values[3] = CStringGetTextDatum(GraphImageString(scan->image, node->label));
+        values[4] = names_to_array(scan->reads[nodeid]);
+        values[5] = names_to_array(scan->writes[nodeid]);
+
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+Datum pg_plsql_graph_nodes(PG_FUNCTION_ARGS){
+    return graph_nodes_internal(fcinfo, false);
+}
+
+Datum pg_plsql_graph_nodes_by_function(PG_FUNCTION_ARGS){
+    return graph_nodes_internal(fcinfo, true);
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graph_edges);
+PG_FUNCTION_INFO_V1(pg_plsql_graph_edges_by_function);
+
+/*
+ * Returns the edges of a stored graph one row per call, flow edges first
+ * and the dependence edges grouped by kind
+ */
+static Datum
+graph_edges_internal(FunctionCallInfo fcinfo, bool byFunction)
+{
+    FuncCallContext*    funcctx;
+    GraphImage*         image;
+
+    if (SRF_IS_FIRSTCALL())
+    {
+        MemoryContext   oldcontext;
+        TupleDesc       tupdesc;
+
+        funcctx = SRF_FIRSTCALL_INIT();
+        oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+            elog(ERROR, "return type must be a row type");
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        image = graph_image_arg(fcinfo, byFunction);
+        funcctx->user_fctx = image;
+        funcctx->max_calls = image ? image->nedges : 0;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    image = (GraphImage *) funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls)
+    {
+        int             eid = (int) funcctx->call_cntr;
+        GraphImageEdge* edge = &GraphImageEdges(image)[eid];
+        char*           label = GraphImageString(image, edge->label);
+        int             kind = 0;
+        Datum           values[PG_PLSQL_GRAPH_EDGES_COLS];
+        bool            nulls[PG_PLSQL_GRAPH_EDGES_COLS];
+        HeapTuple       tuple;
+
+        /* the edges are grouped by kind */
+        while (kind < NUM_EDGE_KINDS - 1 && eid >= image->edgeStart[kind + 1])
+            kind++;
+
+        memset(nulls, 0, sizeof(nulls));
+        values[0] = Int32GetDatum(edge->from);
+        values[1] = Int32GetDatum(edge->to);
+        values[2] = CStringGetTextDatum(edgeKindName(kind));
+        if (label[0] != '\0')
+            values[3] = CStringGetTextDatum(label);
+        else
+            nulls[3] = true;
+
+        tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+Datum pg_plsql_graph_edges(PG_FUNCTION_ARGS){
+    return graph_edges_internal(fcinfo, false);
+}
+
+Datum pg_plsql_graph_edges_by_function(PG_FUNCTION_ARGS){
+    return graph_edges_internal(fcinfo, true);
+}
+
+
+
+
+
+
+/*
+ * Calculate hash value for a key. The source hash is mixed with the
+ * length by the finalizer of MurmurHash3, so all bits of the key affect
+ * the low bits that select the partition and the bucket.
+ */
+static uint32
+pgpg_hash_key(const pgpgHashKey* key)
+{
+    uint64      h = key->sourcehash ^ ((uint64) (uint32) key->sourcelen << 32);
+
+    h ^= h >> 33;
+    h *= UINT64CONST(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+
+    return (uint32) h;
+}
+
+/*
+ * Calculate hash value for a key, dynahash interface
+ */
+static uint32
+pgpg_hash_fn(const void *key, Size keysize)
+{
+    return pgpg_hash_key((const pgpgHashKey *) key);
+}
+
+/*
+ * Compare two keys - zero means match
+ */
+static int
+pgpg_match_fn(const void *key1, const void *key2, Size keysize)
 {
     const pgpgHashKey *k1 = (const pgpgHashKey *) key1;
     const pgpgHashKey *k2 = (const pgpgHashKey *) key2;
 
-    if (k1->userid == k2->userid &&
-        k1->dbid == k2->dbid &&
-        k1->functionid == k2->functionid &&
-        k1->uniqueid == k2->uniqueid)
-        return 0;
+    if (k1->sourcehash == k2->sourcehash &&
+        k1->sourcelen == k2->sourcelen)
+        return 0;
+    else
+        return 1;
+}
+
+/*
+ * Calculate hash value for a graph id, dynahash interface. The low bits of
+ * an id are the partition of its entry, the hash value keeps them, so the
+ * id index shares the partition locks of the entries.
+ */
+static uint32
+pgpg_id_hash_fn(const void *key, Size keysize)
+{
+    uint64      id = *((const uint64 *) key);
+
+    return DatumGetUInt32(hash_uint32((uint32) (id / PGPG_NUM_PARTITIONS))) * PGPG_NUM_PARTITIONS +
+           (uint32) (id % PGPG_NUM_PARTITIONS);
+}
+
+
+
+
+
+/*
+ * Partition of the entries with the given hash code, dynahash uses the
+ * low bits of the hash code for the partition as well.
+ */
+static pgpgPartition *
+pgpg_partition(uint32 hashcode)
+{
+    return &pgpg->partitions[hashcode % PGPG_NUM_PARTITIONS];
+}
+
+/*
+ * Acquires the lock of a partition, counting whether it had to wait.
+ */
+static void
+pgpg_lock(pgpgPartition* partition, LWLockMode mode)
+{
+    if (LWLockConditionalAcquire(partition->lock, mode))
+        return;
+
+    pg_atomic_fetch_add_u64(&partition->waits, 1);
+    LWLockAcquire(partition->lock, mode);
+}
+
+/*
+ * Acquires the locks of all partitions in order
+ */
+static void
+pgpg_lock_all(LWLockMode mode)
+{
+    for (int p = 0; p < PGPG_NUM_PARTITIONS; p++)
+        pgpg_lock(&pgpg->partitions[p], mode);
+}
+
+/*
+ * Releases the locks of all partitions
+ */
+static void
+pgpg_unlock_all(void)
+{
+    for (int p = PGPG_NUM_PARTITIONS - 1; p >= 0; p--)
+        LWLockRelease(pgpg->partitions[p].lock);
+}
+
+
+/*
+ * Initializes the activity counters at startup
+ */
+static void
+stats_init(void)
+{
+    pgpgStats*  stats = &pgpg->stats;
+
+    pg_atomic_init_u64(&stats->captures, 0);
+    pg_atomic_init_u64(&stats->evictions, 0);
+    pg_atomic_init_u64(&stats->bytes_stored, 0);
+    pg_atomic_init_u64(&stats->truncated, 0);
+    pg_atomic_init_u64(&stats->unsupported, 0);
+    for (int stage = 0; stage < PGPG_NUM_STAGES; stage++)
+    {
+        pg_atomic_init_u64(&stats->latency[stage].calls, 0);
+        pg_atomic_init_u64(&stats->latency[stage].total_us, 0);
+        for (int b = 0; b < PGPG_LATENCY_BUCKETS; b++)
+            pg_atomic_init_u64(&stats->latency[stage].buckets[b], 0);
+    }
+    pgpg->stats_reset = GetCurrentTimestamp();
+}
+
+
+/*
+ * Zeroes the activity counters, also the cache hits and lock waits of the
+ * partitions. Counts added concurrently may be lost.
+ */
+static void
+stats_clear(void)
+{
+    volatile pgpgSharedState *vs = (volatile pgpgSharedState *) pgpg;
+    pgpgStats*  stats = &pgpg->stats;
+
+    for (int p = 0; p < PGPG_NUM_PARTITIONS; p++)
+    {
+        pg_atomic_write_u64(&pgpg->partitions[p].waits, 0);
+        pg_atomic_write_u64(&pgpg->partitions[p].hits, 0);
+    }
+
+    pg_atomic_write_u64(&stats->captures, 0);
+    pg_atomic_write_u64(&stats->evictions, 0);
+    pg_atomic_write_u64(&stats->bytes_stored, 0);
+    pg_atomic_write_u64(&stats->truncated, 0);
+    pg_atomic_write_u64(&stats->unsupported, 0);
+    for (int stage = 0; stage < PGPG_NUM_STAGES; stage++)
+    {
+        pg_atomic_write_u64(&stats->latency[stage].calls, 0);
+        pg_atomic_write_u64(&stats->latency[stage].total_us, 0);
+        for (int b = 0; b < PGPG_LATENCY_BUCKETS; b++)
+            pg_atomic_write_u64(&stats->latency[stage].buckets[b], 0);
+    }
+
+    SpinLockAcquire(&vs->mutex);
+    vs->stats_reset = GetCurrentTimestamp();
+    SpinLockRelease(&vs->mutex);
+}
+
+
+/*
+ * Records the duration of a stage that began at start
+ */
+static void
+stats_time(pgpgStage stage, instr_time start)
+{
+    pgpgLatency* latency;
+    instr_time  duration;
+    uint64      us;
+    int         bucket = 0;
+
+    if (!pgpg)
+        return;
+
+    INSTR_TIME_SET_CURRENT(duration);
+    INSTR_TIME_SUBTRACT(duration, start);
+    us = INSTR_TIME_GET_MICROSEC(duration);
+
+    while (bucket < PGPG_LATENCY_BUCKETS - 1 && us >= (UINT64CONST(1) << bucket))
+        bucket++;
+
+    latency = &pgpg->stats.latency[stage];
+    pg_atomic_fetch_add_u64(&latency->calls, 1);
+    pg_atomic_fetch_add_u64(&latency->total_us, us);
+    pg_atomic_fetch_add_u64(&latency->buckets[bucket], 1);
+}
+
+
+/*
+ * Counts a call of the function of the entry with the given key.
+ * Returns false if there is no such entry.
+ */
+static bool
+entry_count_call(pgpgHashKey* key, pgpgCaller* caller, TimestampTz called)
+{
+    pgpgEntry*      entry;
+    uint32          hashcode = pgpg_hash_key(key);
+    pgpgPartition*  partition = pgpg_partition(hashcode);
+
+    pgpg_lock(partition, LW_SHARED);
+
+    entry = (pgpgEntry *) hash_search_with_hash_value(pgpg_hash, key, hashcode,
+                                                      HASH_FIND, NULL);
+    if(entry)
+        entry_record_call(entry,caller,called);
+
+    LWLockRelease(partition->lock);
+
+    if(entry)
+        pg_atomic_fetch_add_u64(&partition->hits, 1);
+
+    return entry != NULL;
+}
+
+
+/*
+ * Records a call of the given caller at the given time in the counters of
+ * the entry, by default those of the current user, database and statement.
+ * Caller must hold the partition lock of the entry, the counters are
+ * protected by the entry mutex.
+ */
+static void
+entry_record_call(pgpgEntry* entry, pgpgCaller* caller, TimestampTz called)
+{
+    volatile pgpgEntry *e = (volatile pgpgEntry *) entry;
+    TimestampTz now = called ? called : GetCurrentStatementStartTimestamp();
+    Oid         userid = caller ? caller->userid : GetUserId();
+    Oid         dbid = caller ? caller->dbid : MyDatabaseId;
+    int         c;
+
+    SpinLockAcquire(&e->mutex);
+
+    e->counters.calls++;
+    e->counters.usage += USAGE_EXEC;
+    if(e->counters.first_seen == 0)
+        e->counters.first_seen = now;
+    e->counters.last_seen = now;
+
+    /* remember the caller if it is a new one and there is space left */
+    for(c=0;c<e->counters.ncallers;c++){
+        if(e->counters.callers[c].userid == userid &&
+           e->counters.callers[c].dbid == dbid)
+            break;
+    }
+    if(c == e->counters.ncallers && c < PGPG_MAX_CALLERS){
+        e->counters.callers[c].userid = userid;
+        e->counters.callers[c].dbid = dbid;
+        e->counters.ncallers++;
+    }
+
+    SpinLockRelease(&e->mutex);
+}
+
+
+/*
+ * Publishes a capture to the ring of recent captures without a lock, by
+ * default one of the current backend and statement. Only new and changed
+ * graphs are published, calls that find their graph stored are not.
+ * When the ring wrapped around and another writer holds the slot, or
+ * published a later position in it already, the capture is dropped.
+ */
+static void
+recent_publish(pgpgHashKey* key, pgpgCaller* caller, TimestampTz called)
+{
+    uint64      pos = pg_atomic_fetch_add_u64(&pgpg->recent_head, 1);
+    pgpgRecent* recent = &pgpg->recent[pos % PGPG_RECENT_SIZE];
+    uint64      seq = pg_atomic_read_u64(&recent->seq);
+
+    if ((seq & 1) || seq >= 2 * (pos + 1) ||
+        !pg_atomic_compare_exchange_u64(&recent->seq, &seq, seq | 1))
+        return;
+    pg_write_barrier();
+
+    recent->key = *key;
+    if (caller)
+        recent->caller = *caller;
+    else
+    {
+        recent->caller.userid = GetUserId();
+        recent->caller.dbid = MyDatabaseId;
+        recent->caller.pid = MyProcPid;
+    }
+    recent->called = called ? called : GetCurrentStatementStartTimestamp();
+
+    pg_write_barrier();
+    pg_atomic_write_u64(&recent->seq, 2 * (pos + 1));
+}
+
+
+/*
+ * Copies the capture at the given position of the ring. Returns false if
+ * it was overwritten already or is being written.
+ */
+static bool
+recent_read(uint64 pos, pgpgRecent* recent)
+{
+    pgpgRecent* slot = &pgpg->recent[pos % PGPG_RECENT_SIZE];
+
+    if (pg_atomic_read_u64(&slot->seq) != 2 * (pos + 1))
+        return false;
+    pg_read_barrier();
+
+    recent->key = slot->key;
+    recent->caller = slot->caller;
+    recent->called = slot->called;
+
+    pg_read_barrier();
+    return pg_atomic_read_u64(&slot->seq) == 2 * (pos + 1);
+}
+
+
+/*
+ * Adds the counters of a build context and its children, as their stats
+ * methods report them, to *totals.
+ */
+static void
+build_memory_count(MemoryContext context, MemoryContextCounters* totals)
+{
+    MemoryContext   child;
+
+    context->methods->stats(context, 0, false, totals);
+
+    for (child = context->firstchild; child != NULL; child = child->nextchild)
+        build_memory_count(child, totals);
+}
+
+
+/*
+ * Samples the memory allocated by a build context and keeps the largest
+ * sample in *peak. Builds are sampled after every stage, as chunks freed
+ * in between go back to the contexts.
+ */
+static void
+build_memory_sample(MemoryContext context, int64* peak)
+{
+    MemoryContextCounters totals;
+
+    memset(&totals, 0, sizeof(totals));
+    build_memory_count(context, &totals);
+
+    if ((int64) totals.totalspace > *peak)
+        *peak = (int64) totals.totalspace;
+}
+
+
+/*
+ * Compresses an image for storage. Returns the compressed data, or the
+ * image itself if compression does not save enough.
+ */
+static char *
+compress_image(GraphImage* image, int32* storedSize)
+{
+    char* compressed = palloc(PGLZ_MAX_OUTPUT(image->size));
+
+    *storedSize = pglz_compress((char*) image, image->size,
+                                compressed, PGLZ_strategy_default);
+    if (*storedSize < 0)
+    {
+        pfree(compressed);
+        *storedSize = image->size;
+        return (char*) image;
+    }
+    return compressed;
+}
+
+
+/*
+ * Allocate a new hashtable entry, or replace the graph of an existing one
+ * if replace is set, and count the call of the given caller. The image is
+ * stored as storedData, which is the image itself or its compressed form.
+ * Returns false if there was no space for the entry.
+ *
+ * Usually only the partition of the key is locked. Making space needs the
+ * locks of all partitions, which are then acquired instead.
+ */
+static bool
+entry_alloc(pgpgHashKey*    key,
+            bool            replace,
+            char*           functionName,
+            GraphImage*     image,
+            char*           storedData,
+            int32           storedSize,
+            int64           buildMemory,
+            pgpgCaller*     caller,
+            TimestampTz     called)
+{
+    pgpgEntry  *entry;
+    uint32      hashcode = pgpg_hash_key(key);
+    pgpgPartition* partition = pgpg_partition(hashcode);
+    Size        nameSize = MAXALIGN(strlen(functionName) + 1);
+    Size        offset = 0;
+    Size        payloadSize = nameSize + MAXALIGN(storedSize);
+    bool        truncated = false;
+    bool        lockedAll = false;
+    bool        stored = false;
+    bool        found;
+
+    pgpg_lock(partition, LW_EXCLUSIVE);
+
+    /* nothing to store for an existing entry that is kept */
+    entry = (pgpgEntry *) hash_search_with_hash_value(pgpg_hash, key, hashcode,
+                                                      HASH_FIND, NULL);
+    if (!entry || replace)
+    {
+        /*
+         * Other partitions may add an entry concurrently, keep one free
+         * slot for each of them.
+         */
+        if (hash_get_num_entries(pgpg_hash) >= pgpg_max - PGPG_NUM_PARTITIONS ||
+            !storage_reserve(payloadSize, &offset))
+        {
+            LWLockRelease(partition->lock);
+            pgpg_lock_all(LW_EXCLUSIVE);
+            lockedAll = true;
+
+            /* Make space if needed */
+            while (hash_get_num_entries(pgpg_hash) >= pgpg_max)
+                entry_dealloc();
+
+            /* Graphs too large for the storage keep only their name */
+            if (!storage_alloc(payloadSize, &offset))
+            {
+                truncated = true;
+                payloadSize = nameSize;
+                if (!storage_alloc(payloadSize, &offset))
+                {
+                    pgpg_unlock_all();
+                    return false;
+                }
+            }
+        }
+
+        /* Find or create an entry with desired hash code, it may have been evicted */
+        entry = (pgpgEntry *) hash_search_with_hash_value(pgpg_hash, key, hashcode,
+                                                          HASH_ENTER, &found);
+        entry_fill(entry, found, offset, payloadSize, truncated, functionName,
+                   image, storedData, storedSize, buildMemory);
+        stored = true;
+    }
+
+    /* count the current call */
+    entry_record_call(entry, caller, called);
+
+    if (lockedAll)
+        pgpg_unlock_all();
+    else
+        LWLockRelease(partition->lock);
+
+    /* the new or changed graph is the latest capture now */
+    if (stored)
+        recent_publish(key, caller, called);
+
+    return true;
+}
+
+
+/*
+ * Sets the graph of a new (found not set) or rebuilt entry, whose payload
+ * was allocated at offset. Caller must hold an exclusive lock on the partition of the
+ * entry.
+ */
+static void
+entry_fill(pgpgEntry*      entry,
+           bool            found,
+           Size            offset,
+           Size            payloadSize,
+           bool            truncated,
+           char*           functionName,
+           GraphImage*     image,
+           char*           storedData,
+           int32           storedSize,
+           int64           buildMemory)
+{
+    volatile pgpgSharedState *s = (volatile pgpgSharedState *) pgpg;
+    int         nameLen = strlen(functionName);
+    uint64      seq;
+
+    SpinLockAcquire(&s->mutex);
+    seq = s->counter++;
+    /* a rebuilt entry, its old payload becomes garbage */
+    if (found)
+        s->storage_live -= entry->graph.payloadSize;
+    SpinLockRelease(&s->mutex);
+
+    /* a rebuilt graph gets a new id */
+    if (found)
+        id_index_remove(entry);
+
+    /* New entry, initialize it */
+    if (!found)
+    {
+        /* reset the statistics */
+        memset(&entry->counters, 0, sizeof(pgpgCounters));
+        entry->counters.usage = USAGE_INIT;
+        SpinLockInit(&entry->mutex);
+    }
+
+    /* set the graphs */
+    memset(&entry->graph, 0, sizeof(GraphStruct));
+    entry->graph.id = graph_id_make(seq, &entry->key);
+    id_index_set(entry);
+    entry->graph.offset = offset;
+    entry->graph.payloadSize = payloadSize;
+    entry->graph.nameLen = nameLen;
+    entry->graph.buildMemory = buildMemory;
+    entry->graph.truncated = truncated;
+    memcpy(entry_function_name(entry), functionName, nameLen + 1);
+    if (!truncated)
+    {
+        entry->graph.imageSize = image->size;
+        entry->graph.storedSize = storedSize;
+        entry->graph.compressed = storedData != (char*) image;
+        memcpy(entry_image_data(entry), storedData, storedSize);
+        pg_atomic_fetch_add_u64(&pgpg->stats.bytes_stored, storedSize);
+    }
+    else
+        pg_atomic_fetch_add_u64(&pgpg->stats.truncated, 1);
+}
+
+
+/*
+ * Copies an entry, its function name and its stored image to local
+ * memory. Caller must hold the partition lock of the entry.
+ */
+static void
+entry_snapshot(pgpgEntry* entry, pgpgSnapshot* snapshot)
+{
+    snapshot->key = entry->key;
+    entry_copy_counters(entry, &snapshot->counters);
+    snapshot->graph = entry->graph;
+    snapshot->functionName = pstrdup(entry_function_name(entry));
+    snapshot->storedData = NULL;
+    if (!entry->graph.truncated)
+    {
+        snapshot->storedData = palloc(entry->graph.storedSize);
+        memcpy(snapshot->storedData, entry_image_data(entry),
+               entry->graph.storedSize);
+    }
+}
+
+
+/*
+ * Returns the image of a snapshot, properly aligned and decompressed.
+ * Returns NULL if the graph was too large to be stored.
+ */
+static GraphImage *
+snapshot_image(pgpgSnapshot* snapshot)
+{
+    GraphImage* image;
+
+    if (snapshot->graph.truncated)
+        return NULL;
+
+    image = palloc(snapshot->graph.imageSize);
+    if (!snapshot->graph.compressed)
+        memcpy(image,snapshot->storedData,snapshot->graph.imageSize);
+    else if (pglz_decompress(snapshot->storedData, snapshot->graph.storedSize,
+                             (char*) image, snapshot->graph.imageSize) < 0)
+        elog(ERROR, "compressed graph image of \"%s\" is corrupt",
+             snapshot->functionName);
+
+    return image;
+}
+
+
+/*
+ * Frees the copies of a snapshot
+ */
+static void
+snapshot_free(pgpgSnapshot* snapshot)
+{
+    pfree(snapshot->functionName);
+    if (snapshot->storedData)
+        pfree(snapshot->storedData);
+}
+
+
+/*
+ * Copies the function name and the image of the entry with the given key
+ * to local memory, and sets its graph id if graphId is given. The image is
+ * NULL if the graph was too large to be stored. Returns false if there is
+ * no such entry.
+ */
+static bool
+entry_copy_by_key(pgpgHashKey* key, char** functionName, GraphImage** image,
+                  int64* graphId)
+{
+    pgpgEntry*      entry;
+    uint32          hashcode = pgpg_hash_key(key);
+    pgpgPartition*  partition = pgpg_partition(hashcode);
+    pgpgSnapshot    snapshot;
+
+    pgpg_lock(partition, LW_SHARED);
+
+    entry = (pgpgEntry *) hash_search_with_hash_value(pgpg_hash, key, hashcode,
+                                                      HASH_FIND, NULL);
+    if (entry)
+        entry_snapshot(entry, &snapshot);
+
+    LWLockRelease(partition->lock);
+
+    if (!entry)
+        return false;
+
+    /* decompress without the lock */
+    *functionName = snapshot.functionName;
+    *image = snapshot_image(&snapshot);
+    if (graphId)
+        *graphId = snapshot.graph.id;
+    if (snapshot.storedData)
+        pfree(snapshot.storedData);
+
+    return true;
+}
+
+
+/*
+ * Finds the entry with the given graph id and copies its image to local
+ * memory. Returns NULL if there is no such entry or its graph was too
+ * large to be stored. Only the partition of the entry is locked.
+ */
+static GraphImage *
+entry_find_image(int64 graphId)
+{
+    pgpgIdEntry*    identry;
+    pgpgEntry*      entry = NULL;
+    uint32          hashcode;
+    pgpgPartition*  partition;
+    pgpgSnapshot    snapshot;
+    GraphImage*     image;
+
+    /* ids are never negative */
+    if (graphId < 0)
+        return NULL;
+
+    hashcode = pgpg_id_hash_fn(&graphId, sizeof(int64));
+    partition = pgpg_partition(hashcode);
+
+    pgpg_lock(partition, LW_SHARED);
+
+    identry = (pgpgIdEntry *) hash_search_with_hash_value(pgpg_id_index, &graphId, hashcode,
+                                                          HASH_FIND, NULL);
+    if (identry)
+        entry = (pgpgEntry *) hash_search(pgpg_hash, &identry->entrykey, HASH_FIND, NULL);
+    if (entry)
+        entry_snapshot(entry, &snapshot);
+
+    LWLockRelease(partition->lock);
+
+    if(entry == NULL)
+        return NULL;
+
+    /* decompress without the lock */
+    image = snapshot_image(&snapshot);
+    snapshot_free(&snapshot);
+
+    return image;
+}
+
+
+/*
+ * Sets the graph id of the entry with the given key without copying its
+ * image. Returns false if there is no such entry or its graph was too
+ * large to be stored.
+ */
+static bool
+entry_find_graph_id(pgpgHashKey* key, int64* graphId)
+{
+    pgpgEntry*      entry;
+    uint32          hashcode = pgpg_hash_key(key);
+    pgpgPartition*  partition = pgpg_partition(hashcode);
+    bool            found = false;
+
+    pgpg_lock(partition, LW_SHARED);
+
+    entry = (pgpgEntry *) hash_search_with_hash_value(pgpg_hash, key, hashcode,
+                                                      HASH_FIND, NULL);
+    if (entry && !entry->graph.truncated)
+    {
+        *graphId = entry->graph.id;
+        found = true;
+    }
+
+    LWLockRelease(partition->lock);
+
+    return found;
+}
+
+
+/*
+ * Returns true if a graph with the given id is stored
+ */
+static bool
+id_index_contains(int64 graphId)
+{
+    uint32          hashcode;
+    pgpgPartition*  partition;
+    bool            found;
+
+    if (graphId < 0)
+        return false;
+
+    hashcode = pgpg_id_hash_fn(&graphId, sizeof(int64));
+    partition = pgpg_partition(hashcode);
+
+    pgpg_lock(partition, LW_SHARED);
+    found = hash_search_with_hash_value(pgpg_id_index, &graphId, hashcode,
+                                        HASH_FIND, NULL) != NULL;
+    LWLockRelease(partition->lock);
+
+    return found;
+}
+
+
+/*
+ * Returns the reachability closure of the stored graph with the given id,
+ * or NULL if there is no such graph or it was too large to be stored. The
+ * closure of the last graph is kept, so further questions about the same
+ * graph only check that it is still stored.
+ */
+static pgpgReachCache *
+reach_cache_get(int64 graphId)
+{
+    GraphImage*     image;
+    GraphImageNode* nodes;
+    GraphImageEdge* edges;
+    int             nflow;
+    int*            edgeFrom;
+    int*            edgeTo;
+    MemoryContext   oldcontext;
+
+    if (pgpg_reach_cache.graphId == graphId)
+    {
+        if (id_index_contains(graphId))
+            return &pgpg_reach_cache;
+        return NULL;
+    }
+
+    image = entry_find_image(graphId);
+    if (image == NULL)
+        return NULL;
+
+    /* the previous closure is dropped even if this one fails */
+    if (pgpg_reach_context == NULL)
+        pgpg_reach_context = AllocSetContextCreate(TopMemoryContext,
+                                                   "pg_plsql_graphs reachability",
+                                                   ALLOCSET_DEFAULT_MINSIZE,
+                                                   ALLOCSET_DEFAULT_INITSIZE,
+                                                   ALLOCSET_DEFAULT_MAXSIZE);
+    else
+        MemoryContextReset(pgpg_reach_context);
+    pgpg_reach_cache.graphId = -1;
+
+    oldcontext = MemoryContextSwitchTo(pgpg_reach_context);
+
+    /* the flow edges come first in the image */
+    nodes = GraphImageNodes(image);
+    edges = GraphImageEdges(image);
+    nflow = image->edgeStart[EDGE_FLOW + 1] - image->edgeStart[EDGE_FLOW];
+    edgeFrom = palloc(Max(nflow,1) * sizeof(int));
+    edgeTo = palloc(Max(nflow,1) * sizeof(int));
+    for (int e = 0; e < nflow; e++)
+    {
+        edgeFrom[e] = edges[image->edgeStart[EDGE_FLOW] + e].from;
+        edgeTo[e] = edges[image->edgeStart[EDGE_FLOW] + e].to;
+    }
+
+    pgpg_reach_cache.reach = computeReachability(image->nnodes, nflow,
+                                                 edgeFrom, edgeTo, true);
+    pgpg_reach_cache.nnodes = image->nnodes;
+    pgpg_reach_cache.linenos = palloc(Max(image->nnodes,1) * sizeof(int32));
+    for (int n = 0; n < image->nnodes; n++)
+        pgpg_reach_cache.linenos[n] = nodes[n].lineno;
+
+    pfree(edgeFrom);
+    pfree(edgeTo);
+    MemoryContextSwitchTo(oldcontext);
+    pfree(image);
+
+    pgpg_reach_cache.graphId = graphId;
+    return &pgpg_reach_cache;
+}
+
+
+/*
+ * Graph id of the seq-th stored graph. The partition of the entry is kept
+ * in the low bits of the id.
+ */
+static int64
+graph_id_make(uint64 seq, pgpgHashKey* key)
+{
+    return (int64) (seq * PGPG_NUM_PARTITIONS +
+                    pgpg_hash_key(key) % PGPG_NUM_PARTITIONS);
+}
+
+
+/*
+ * Adds the graph of an entry to the id index. Caller must hold an
+ * exclusive lock on the partition of the entry, which guards the index
+ * entry as well.
+ */
+static void
+id_index_set(pgpgEntry* entry)
+{
+    pgpgIdEntry*    identry;
+
+    identry = (pgpgIdEntry *) hash_search(pgpg_id_index, &entry->graph.id, HASH_ENTER, NULL);
+    identry->entrykey = entry->key;
+}
+
+
+/*
+ * Removes the graph of an entry from the id index. Caller must hold an
+ * exclusive lock on the partition of the entry.
+ */
+static void
+id_index_remove(pgpgEntry* entry)
+{
+    hash_search(pgpg_id_index, &entry->graph.id, HASH_REMOVE, NULL);
+}
+
+
+/*
+ * Seeds the statement memo from the stored graph of the version of the
+ * function that was called before, if it is still stored. The memo of a
+ * process is lost when it exits, the stored graph is not, so the sets are
+ * reused although the worker that built the previous version is gone.
+ */
+static void
+memo_seed_previous(PLpgSQL_function* function)
+{
+    pgpgHashKey     key;
+    char*           functionName;
+    GraphImage*     image;
+
+    if (!OidIsValid(function->fn_oid) ||
+        !index_lookup(MyDatabaseId, function->fn_oid, &key) ||
+        !entry_copy_by_key(&key, &functionName, &image, NULL))
+        return;
+
+    if (image != NULL)
+    {
+        seedStmtMemo(image);
+        pfree(image);
+    }
+    pfree(functionName);
+}
+
+
+/*
+ * Copies the image of the graph given by the first argument of a function
+ * call to local memory, either a graph id or a function of the current
+ * database. Returns NULL if there is no such graph or it was too large to
+ * be stored.
+ */
+static GraphImage *
+graph_image_arg(FunctionCallInfo fcinfo, bool byFunction)
+{
+    pgpgHashKey     key;
+    char*           functionName;
+    GraphImage*     image;
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    if (!byFunction)
+        return entry_find_image(PG_GETARG_INT64(0));
+
+    if (!index_lookup(MyDatabaseId, PG_GETARG_OID(0), &key) ||
+        !entry_copy_by_key(&key, &functionName, &image, NULL))
+        return NULL;
+
+    pfree(functionName);
+    return image;
+}
+
+
+/*
+ * qsort comparator for sorting into increasing usage order
+ */
+static int
+entry_cmp(const void* lhs, const void* rhs)
+{
+    double      l_usage = (*(pgpgEntry* const*) lhs)->counters.usage;
+    double      r_usage = (*(pgpgEntry* const*) rhs)->counters.usage;
+
+    if (l_usage < r_usage)
+        return -1;
+    else if (l_usage > r_usage)
+        return +1;
+    else
+        return 0;
+}
+
+
+/*
+ * Deallocate least used entries. The usage of all entries decays, so
+ * functions that are no longer called lose against recently called ones.
+ * Caller must hold exclusive locks on all partitions.
+ */
+static void
+entry_dealloc(void)
+{
+    HASH_SEQ_STATUS hash_seq;
+    pgpgEntry**     entries;
+    pgpgEntry*      entry;
+    int             nvictims;
+    int             i;
+
+    /*
+     * Sort entries by usage and deallocate USAGE_DEALLOC_PERCENT of them.
+     * While we're scanning the table, apply the decay factor to the usage
+     * values. The counters are only read under an exclusive lock, so the
+     * entry mutex is not needed.
+     */
+    entries = palloc(hash_get_num_entries(pgpg_hash) * sizeof(pgpgEntry *));
+
+    i = 0;
+    hash_seq_init(&hash_seq, pgpg_hash);
+    while ((entry = hash_seq_search(&hash_seq)) != NULL)
+    {
+        entries[i++] = entry;
+        entry->counters.usage *= USAGE_DECREASE_FACTOR;
+    }
+
+    qsort(entries, i, sizeof(pgpgEntry *), entry_cmp);
+
+    nvictims = Max(10, i * USAGE_DEALLOC_PERCENT / 100);
+    nvictims = Min(nvictims, i);
+
+    for (i = 0; i < nvictims; i++)
+        entry_remove(entries[i]);
+    pg_atomic_fetch_add_u64(&pgpg->stats.evictions, nvictims);
+
+    pfree(entries);
+
+    index_prune();
+}
+
+
+/*
+ * Takes one of the pgpg_max slots of the function index for a new
+ * function. Returns false if all are taken.
+ */
+static bool
+index_reserve_slot(void)
+{
+    if (pg_atomic_fetch_add_u32(&pgpg->nindexed, 1) < (uint32) pgpg_max)
+        return true;
+    pg_atomic_fetch_sub_u32(&pgpg->nindexed, 1);
+    return false;
+}
+
+
+/*
+ * Enters a function into the function index on a reserved slot, which is
+ * given back if shared memory ran out nevertheless. Caller must hold an
+ * exclusive lock on the partition of the function.
+ */
+static pgpgFunctionEntry *
+index_enter(pgpgFunctionKey* fkey, uint32 hashcode)
+{
+    pgpgFunctionEntry*  fentry;
+
+    fentry = (pgpgFunctionEntry *) hash_search_with_hash_value(pgpg_function_index,
+                                                               fkey, hashcode,
+                                                               HASH_ENTER_NULL, NULL);
+    if (!fentry)
+        pg_atomic_fetch_sub_u32(&pgpg->nindexed, 1);
+    return fentry;
+}
+
+
+/*
+ * Maps a function to the entry of its latest version in the function index.
+ * The index holds at most pgpg_max functions, shared memory beyond its
+ * estimate is left to the other tables. If it is full its entries of
+ * evicted graphs are removed first; if all of them still have graphs the
+ * function is not indexed and can only be found by a scan.
+ */
+static void
+index_set(Oid dbid, Oid functionid, pgpgHashKey* key)
+{
+    pgpgFunctionKey     fkey;
+    pgpgFunctionEntry*  fentry;
+    uint32              hashcode;
+    pgpgPartition*      partition;
+
+    if (!pgpg || !pgpg_function_index)
+        return;
+
+    memset(&fkey, 0, sizeof(fkey));
+    fkey.dbid = dbid;
+    fkey.functionid = functionid;
+    hashcode = get_hash_value(pgpg_function_index, &fkey);
+    partition = pgpg_partition(hashcode);
+
+    pgpg_lock(partition, LW_EXCLUSIVE);
+    fentry = (pgpgFunctionEntry *) hash_search_with_hash_value(pgpg_function_index,
+                                                               &fkey, hashcode,
+                                                               HASH_FIND, NULL);
+    if (!fentry && index_reserve_slot())
+        fentry = index_enter(&fkey, hashcode);
+    if (fentry)
+        fentry->entrykey = *key;
+    LWLockRelease(partition->lock);
+
+    if (fentry)
+        return;
+
+    /* the index is full, functions without graphs make space */
+    pgpg_lock_all(LW_EXCLUSIVE);
+    index_prune();
+    fentry = (pgpgFunctionEntry *) hash_search_with_hash_value(pgpg_function_index,
+                                                               &fkey, hashcode,
+                                                               HASH_FIND, NULL);
+    if (!fentry && index_reserve_slot())
+        fentry = index_enter(&fkey, hashcode);
+    if (fentry)
+        fentry->entrykey = *key;
     else
-        return 1;
+        elog(DEBUG1, "pg_plsql_graphs function index is full, function %u is not indexed",
+             functionid);
+    pgpg_unlock_all();
+}
+
+
+/*
+ * Finds the key of the entry of a function in the function index.
+ * Returns false if the function is not indexed.
+ */
+static bool
+index_lookup(Oid dbid, Oid functionid, pgpgHashKey* key)
+{
+    pgpgFunctionKey     fkey;
+    pgpgFunctionEntry*  fentry;
+    uint32              hashcode;
+    pgpgPartition*      partition;
+
+    memset(&fkey, 0, sizeof(fkey));
+    fkey.dbid = dbid;
+    fkey.functionid = functionid;
+    hashcode = get_hash_value(pgpg_function_index, &fkey);
+    partition = pgpg_partition(hashcode);
+
+    pgpg_lock(partition, LW_SHARED);
+    fentry = (pgpgFunctionEntry *) hash_search_with_hash_value(pgpg_function_index,
+                                                               &fkey, hashcode,
+                                                               HASH_FIND, NULL);
+    if (fentry)
+        *key = fentry->entrykey;
+    LWLockRelease(partition->lock);
+
+    return fentry != NULL;
 }
 
 
+/*
+ * Removes the functions whose entries were evicted from the function index.
+ * Caller must hold exclusive locks on all partitions.
+ */
+static void
+index_prune(void)
+{
+    HASH_SEQ_STATUS     hash_seq;
+    pgpgFunctionEntry*  fentry;
 
+    hash_seq_init(&hash_seq, pgpg_function_index);
+    while ((fentry = hash_seq_search(&hash_seq)) != NULL)
+    {
+        if (!hash_search(pgpg_hash, &fentry->entrykey, HASH_FIND, NULL))
+        {
+            hash_search(pgpg_function_index, &fentry->key, HASH_REMOVE, NULL);
+            pg_atomic_fetch_sub_u32(&pgpg->nindexed, 1);
+        }
+    }
+}
 
 
 /*
- * Allocate a new hashtable entry.
- * caller must hold an exclusive lock on pgss->lock
+ * Evicts entries ahead of time if the hash table or the graph storage is
+ * almost full, so that backends storing graphs rarely have to. Called by
+ * the background worker between requests.
  */
-static pgpgEntry *
-entry_alloc(pgpgHashKey*    key,
-            bool            sticky,
-            int             id,
-            char*           functionName,
-            char*           flowGraphDot,
-            char*           programDepencenceGraphDot)
+void
+pgpg_reserve_entries(void)
 {
-    pgpgEntry  *entry;
-    bool        found;
+    int     maxEntries = pgpg_max - pgpg_max * USAGE_RESERVE_PERCENT / 100;
+    Size    maxStorage = storage_budget() / 100 * (100 - USAGE_RESERVE_PERCENT);
+    Size    live;
+
+    if (!pgpg || !pgpg_hash)
+        return;
 
-    /* Make space if needed */
-    while (hash_get_num_entries(pgpg_hash) >= pgpg_max){
+    SpinLockAcquire(&pgpg->mutex);
+    live = pgpg->storage_live;
+    SpinLockRelease(&pgpg->mutex);
+
+    /* cheap check without partition locks first, most of the time there is nothing to do */
+    if (hash_get_num_entries(pgpg_hash) < maxEntries && live < maxStorage)
+        return;
+
+    pgpg_lock_all(LW_EXCLUSIVE);
+    while (hash_get_num_entries(pgpg_hash) > 0 &&
+           (hash_get_num_entries(pgpg_hash) >= maxEntries ||
+            pgpg->storage_live >= maxStorage))
         entry_dealloc();
+    pgpg_unlock_all();
+}
+
+
+/*
+ * Removes an entry, its payload becomes garbage of the storage.
+ * Caller must hold exclusive locks on all partitions.
+ */
+static void
+entry_remove(pgpgEntry* entry)
+{
+    pgpg->storage_live -= entry->graph.payloadSize;
+    id_index_remove(entry);
+    hash_search(pgpg_hash, &entry->key, HASH_REMOVE, NULL);
+}
+
+
+/*
+ * Size of the graph storage in shared memory
+ */
+static Size
+storage_size(void)
+{
+    return (Size) pgpg_max_storage * 1024;
+}
+
+
+/*
+ * Usable part of the graph storage, it can be changed without a restart
+ */
+static Size
+storage_budget(void)
+{
+    if (pgpg_storage_budget < 0 || pgpg_storage_budget > pgpg_max_storage)
+        return storage_size();
+    return (Size) pgpg_storage_budget * 1024;
+}
+
+
+/*
+ * Allocates size bytes of the graph storage if they are free at its end
+ * and within the budget, without evicting or moving other entries.
+ * Returns false otherwise. Caller must hold a partition lock.
+ */
+static bool
+storage_reserve(Size size, Size* offset)
+{
+    volatile pgpgSharedState *s = (volatile pgpgSharedState *) pgpg;
+    Size        budget = storage_budget();
+    bool        reserved = false;
+
+    SpinLockAcquire(&s->mutex);
+    if (s->storage_live + size <= budget && s->storage_used + size <= budget)
+    {
+        *offset = s->storage_used;
+        s->storage_used += size;
+        s->storage_live += size;
+        reserved = true;
     }
+    SpinLockRelease(&s->mutex);
 
-    /* Find or create an entry with desired hash code */
-    entry = (pgpgEntry *) hash_search(pgpg_hash, key, HASH_ENTER, &found);
+    return reserved;
+}
 
-    if (!found)
+
+/*
+ * Allocates size bytes of the graph storage and returns their offset.
+ * Payloads are appended to the used part of the storage. If the budget
+ * is exceeded entries are evicted, and if the remaining space is
+ * fragmented the payloads are moved together first. Returns false if
+ * size exceeds the budget.
+ * Caller must hold exclusive locks on all partitions.
+ */
+static bool
+storage_alloc(Size size, Size* offset)
+{
+    Size budget = storage_budget();
+
+    if (size > budget)
+        return false;
+
+    /* evict entries until the payload fits into the budget */
+    while (pgpg->storage_live + size > budget &&
+           hash_get_num_entries(pgpg_hash) > 0)
+        entry_dealloc();
+
+    /* there is enough space, but it may be scattered */
+    if (pgpg->storage_used + size > budget)
+        storage_gc();
+
+    *offset = pgpg->storage_used;
+    pgpg->storage_used += size;
+    pgpg->storage_live += size;
+    return true;
+}
+
+
+/*
+ * qsort comparator of entries by the offset of their payload
+ */
+static int
+storage_offset_cmp(const void* a, const void* b)
+{
+    Size    off1 = (*(pgpgEntry* const*) a)->graph.offset;
+    Size    off2 = (*(pgpgEntry* const*) b)->graph.offset;
+
+    if (off1 < off2)
+        return -1;
+    else if (off1 > off2)
+        return 1;
+    else
+        return 0;
+}
+
+
+/*
+ * Moves the payloads of all entries to the start of the storage, in the
+ * order they are stored, so that the free space is in one piece.
+ * Caller must hold exclusive locks on all partitions.
+ */
+static void
+storage_gc(void)
+{
+    HASH_SEQ_STATUS hash_seq;
+    pgpgEntry*      entry;
+    pgpgEntry**     entries;
+    int             nentries = 0;
+    Size            used = 0;
+
+    entries = palloc(Max(hash_get_num_entries(pgpg_hash),1) * sizeof(pgpgEntry*));
+
+    hash_seq_init(&hash_seq, pgpg_hash);
+    while ((entry = hash_seq_search(&hash_seq)) != NULL)
+        entries[nentries++] = entry;
+
+    qsort(entries, nentries, sizeof(pgpgEntry*), storage_offset_cmp);
+
+    /* the payloads only move towards the start */
+    for (int e = 0; e < nentries; e++)
     {
-        /* New entry, initialize it */
+        entry = entries[e];
+        if (entry->graph.offset != used)
+            memmove(pgpg_storage + used,
+                    pgpg_storage + entry->graph.offset,
+                    entry->graph.payloadSize);
+        entry->graph.offset = used;
+        used += entry->graph.payloadSize;
+    }
+
+    pgpg->storage_used = used;
+    pgpg->storage_live = used;
+
+    pfree(entries);
+}
+
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_lock_waits);
+
+/**
+ * Returns for every partition of the hash table how often its lock
+ * could not be acquired at once
+ */
+Datum pg_plsql_graphs_lock_waits(PG_FUNCTION_ARGS){
+
+    TupleDesc           tupdesc;
+    Tuplestorestate*    tupstore = graphs_begin(fcinfo, &tupdesc);
+
+    /* the counters are read without locks, they only grow until a reset */
+    for(int p=0;p<PGPG_NUM_PARTITIONS;p++){
+        Datum   values[PG_PLSQL_GRAPHS_LOCK_WAITS_COLS];
+        bool    nulls[PG_PLSQL_GRAPHS_LOCK_WAITS_COLS];
+
+        memset(nulls, 0, sizeof(nulls));
+        values[0] = Int32GetDatum(p);
+        values[1] = Int64GetDatumFast((int64) pg_atomic_read_u64(&pgpg->partitions[p].waits));
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+    }
+
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_recent_graphs);
+
+/**
+ * Returns the graphs of the latest captures, newest first. The captures
+ * are read from the ring of recent captures, so the hash table is not
+ * scanned. If own_backend is set only captures of calls made by the
+ * current backend are returned, if compact is set dot is in a single line.
+ */
+Datum pg_plsql_recent_graphs(PG_FUNCTION_ARGS){
+
+    TupleDesc           tupdesc;
+    Tuplestorestate*    tupstore = graphs_begin(fcinfo, &tupdesc);
+    int                 limit = PG_GETARG_INT32(0);
+    bool                ownBackend = PG_GETARG_BOOL(1);
+    bool                compact = PG_GETARG_BOOL(2);
+    uint64              head;
+    int                 nrows = 0;
+
+    if (limit < 0 || limit > PGPG_RECENT_SIZE)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("number of recent graphs must be between 0 and %d",
+                        PGPG_RECENT_SIZE)));
+
+    /* walk back from the newest capture, evicted entries are skipped */
+    head = pg_atomic_read_u64(&pgpg->recent_head);
+    for(uint64 pos=head;pos > 0 && head - pos < PGPG_RECENT_SIZE && nrows < limit;pos--){
+        Datum       values[PG_PLSQL_RECENT_GRAPHS_COLS];
+        bool        nulls[PG_PLSQL_RECENT_GRAPHS_COLS];
+        pgpgRecent  recent;
+        char*       functionName;
+        GraphImage* image;
+        int64       graphId;
+
+        if(!recent_read(pos - 1,&recent))
+            continue;
+        if(ownBackend && recent.caller.pid != MyProcPid)
+            continue;
+        if(!entry_copy_by_key(&recent.key,&functionName,&image,&graphId))
+            continue;
+
+        memset(nulls, 0, sizeof(nulls));
+        values[0] = CStringGetTextDatum(functionName);
+        if(image == NULL){
+            /* too large to be stored */
+            nulls[1] = true;
+            nulls[2] = true;
+        }
+        else{
+            instr_time  start;
+
+            INSTR_TIME_SET_CURRENT(start);
+            values[1] = CStringGetTextDatum(convertGraphToFlowGraphDot(image,compact));
+            values[2] = CStringGetTextDatum(convertGraphToProgramDependenceGraphDot(image,compact));
+            stats_time(PGPG_STAGE_RENDER,start);
+        }
+        values[3] = Int64GetDatumFast(graphId);
+        values[4] = Int32GetDatum(recent.caller.pid);
+        values[5] = TimestampTzGetDatum(recent.called);
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+        nrows++;
+    }
+
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_stats);
+
+/**
+ * Returns the activity counters as a single row. The counters are read
+ * without locks, so they may be slightly apart from each other.
+ */
+Datum pg_plsql_graphs_stats(PG_FUNCTION_ARGS){
+
+    TupleDesc   tupdesc;
+    Datum       values[PG_PLSQL_GRAPHS_STATS_COLS];
+    bool        nulls[PG_PLSQL_GRAPHS_STATS_COLS];
+    uint64      hits = 0;
+    uint64      waits = 0;
+    TimestampTz reset;
+    int         i = 0;
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        elog(ERROR, "return type must be a row type");
+
+    for(int p=0;p<PGPG_NUM_PARTITIONS;p++){
+        hits += pg_atomic_read_u64(&pgpg->partitions[p].hits);
+        waits += pg_atomic_read_u64(&pgpg->partitions[p].waits);
+    }
+
+    {
+        volatile pgpgSharedState *s = (volatile pgpgSharedState *) pgpg;
+
+        SpinLockAcquire(&s->mutex);
+        reset = s->stats_reset;
+        SpinLockRelease(&s->mutex);
+    }
+
+    memset(nulls, 0, sizeof(nulls));
+    values[i++] = Int64GetDatumFast((int64) pg_atomic_read_u64(&pgpg->stats.captures));
+    values[i++] = Int64GetDatumFast((int64) hits);
+    values[i++] = Int64GetDatumFast((int64) pg_atomic_read_u64(&pgpg->stats.evictions));
+    values[i++] = Int64GetDatumFast((int64) pg_atomic_read_u64(&pgpg->stats.bytes_stored));
+    values[i++] = Int64GetDatumFast((int64) pg_atomic_read_u64(&pgpg->stats.truncated));
+    values[i++] = Int64GetDatumFast((int64) pg_atomic_read_u64(&pgpg->stats.unsupported));
+    values[i++] = Int64GetDatumFast((int64) waits);
+    values[i++] = TimestampTzGetDatum(reset);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc), values, nulls)));
+}
 
-        /* reset the statistics */
-        memset(&entry->dotStruct, 0, sizeof(DotStruct));
 
-        entry->dotStruct.id = id;
-        strcpy(entry->dotStruct.functionName,functionName);
-        strcpy(entry->dotStruct.flowGraphDot,flowGraphDot);
-        strcpy(entry->dotStruct.programDepencenceGraphDot,programDepencenceGraphDot);
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_stage_latency);
+
+/**
+ * Returns one row per stage with the # of recorded durations, their sum
+ * in ms and their histogram. Element b of the histogram counts durations
+ * below 2^b us (and at least 2^(b-1) us), the last one all longer ones.
+ */
+Datum pg_plsql_graphs_stage_latency(PG_FUNCTION_ARGS){
+
+    TupleDesc        tupdesc;
+    Tuplestorestate* tupstore = graphs_begin(fcinfo, &tupdesc);
+
+    for(int stage=0;stage<PGPG_NUM_STAGES;stage++){
+        pgpgLatency* latency = &pgpg->stats.latency[stage];
+        Datum        buckets[PGPG_LATENCY_BUCKETS];
+        Datum        values[PG_PLSQL_GRAPHS_STAGE_LATENCY_COLS];
+        bool         nulls[PG_PLSQL_GRAPHS_STAGE_LATENCY_COLS];
+
+        for(int b=0;b<PGPG_LATENCY_BUCKETS;b++)
+            buckets[b] = Int64GetDatum((int64) pg_atomic_read_u64(&latency->buckets[b]));
+
+        memset(nulls, 0, sizeof(nulls));
+        values[0] = CStringGetTextDatum(pgpgStageNames[stage]);
+        values[1] = Int64GetDatumFast((int64) pg_atomic_read_u64(&latency->calls));
+        values[2] = Float8GetDatumFast((double) pg_atomic_read_u64(&latency->total_us) / 1000.0);
+        values[3] = PointerGetDatum(construct_array(buckets, PGPG_LATENCY_BUCKETS,
+                                                    INT8OID, sizeof(int64),
+                                                    FLOAT8PASSBYVAL, 'd'));
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
     }
 
-    return entry;
+    tuplestore_donestoring(tupstore);
+
+    return (Datum) 0;
+}
+
+
+PG_FUNCTION_INFO_V1(pg_plsql_graphs_stats_reset);
+
+/**
+ * Resets the activity counters and the stage latencies
+ */
+Datum pg_plsql_graphs_stats_reset(PG_FUNCTION_ARGS){
+
+    /* hash table must exist already */
+    if (!pgpg || !pgpg_hash)
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("pg_plsql_graphs must be loaded via shared_preload_libraries")));
+
+    stats_clear();
+
+    PG_RETURN_VOID();
 }
 
 
 /*
- * Deallocate least used entries.
- * Caller must hold an exclusive lock on pgss->lock.
+ * shmem_shutdown hook: Dump the graphs into a file.
+ *
+ * Note: we don't bother with acquiring locks, because there should be no
+ * other processes running when this is called.
  */
 static void
-entry_dealloc(void)
+pgpg_shmem_shutdown(int code, Datum arg)
+{
+    /* Don't try to dump during a crash. */
+    if (code)
+        return;
+
+    /* Safety check ... shouldn't get here unless shmem is set up. */
+    if (!pgpg || !pgpg_hash)
+        return;
+
+    /* Don't dump if told not to. */
+    if (!pgpg_save_graphs)
+        return;
+
+    pgpg_save();
+}
+
+
+/*
+ * Writes all entries to PGPG_DUMP_FILE, followed by the function index.
+ * The compressed images are written as they are stored. The file is
+ * written under a temporary name and renamed, so a crash leaves the
+ * previous file or none.
+ */
+static void
+pgpg_save(void)
 {
+    FILE*           file;
     HASH_SEQ_STATUS hash_seq;
     pgpgEntry*      entry;
-    int             nvictims = 5;
+    pgpgFunctionEntry* fentry;
+    int32           num_entries = hash_get_num_entries(pgpg_hash);
+    int32           num_functions = hash_get_num_entries(pgpg_function_index);
+    uint32          imageMagic = GRAPH_IMAGE_MAGIC;
+    pg_crc32c       indexCrc;
+
+    file = AllocateFile(PGPG_DUMP_FILE ".tmp", PG_BINARY_W);
+    if (file == NULL)
+        goto error;
+
+    if (fwrite(&PGPG_FILE_HEADER, sizeof(uint32), 1, file) != 1)
+        goto error;
+    if (fwrite(&PGPG_PG_MAJOR_VERSION, sizeof(uint32), 1, file) != 1)
+        goto error;
+    if (fwrite(&imageMagic, sizeof(uint32), 1, file) != 1)
+        goto error;
+    if (fwrite(&num_entries, sizeof(int32), 1, file) != 1)
+        goto error;
 
-    int i = 0;
-    /* iterate hash and free first nvictims items */
     hash_seq_init(&hash_seq, pgpg_hash);
-    while ((entry = hash_seq_search(&hash_seq)) != NULL && i < nvictims)
+    while ((entry = hash_seq_search(&hash_seq)) != NULL)
+    {
+        pgpgFileEntry   header;
+        pg_crc32c       crc;
+        char*           name = entry_function_name(entry);
+        char*           data = entry_image_data(entry);
+
+        memset(&header, 0, sizeof(header));
+        header.key = entry->key;
+        header.counters = entry->counters;
+        header.nameLen = entry->graph.nameLen;
+        header.imageSize = entry->graph.imageSize;
+        header.storedSize = entry->graph.storedSize;
+        header.buildMemory = entry->graph.buildMemory;
+        header.compressed = entry->graph.compressed;
+        header.truncated = entry->graph.truncated;
+
+        INIT_CRC32C(crc);
+        COMP_CRC32C(crc, &header, sizeof(header));
+        COMP_CRC32C(crc, name, header.nameLen + 1);
+        if (!header.truncated)
+            COMP_CRC32C(crc, data, header.storedSize);
+        FIN_CRC32C(crc);
+
+        if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(name, 1, header.nameLen + 1, file) != header.nameLen + 1 ||
+            (!header.truncated &&
+             fwrite(data, 1, header.storedSize, file) != header.storedSize) ||
+            fwrite(&crc, sizeof(crc), 1, file) != 1)
+        {
+            /* note: we assume hash_seq_term won't change errno */
+            hash_seq_term(&hash_seq);
+            goto error;
+        }
+    }
+
+    /* the functions of the entries, lookups by function work after a restart */
+    if (fwrite(&num_functions, sizeof(int32), 1, file) != 1)
+        goto error;
+
+    INIT_CRC32C(indexCrc);
+    hash_seq_init(&hash_seq, pgpg_function_index);
+    while ((fentry = hash_seq_search(&hash_seq)) != NULL)
+    {
+        COMP_CRC32C(indexCrc, fentry, sizeof(pgpgFunctionEntry));
+        if (fwrite(fentry, sizeof(pgpgFunctionEntry), 1, file) != 1)
+        {
+            /* note: we assume hash_seq_term won't change errno */
+            hash_seq_term(&hash_seq);
+            goto error;
+        }
+    }
+    FIN_CRC32C(indexCrc);
+    if (fwrite(&indexCrc, sizeof(pg_crc32c), 1, file) != 1)
+        goto error;
+
+    if (FreeFile(file))
     {
-        hash_search(pgpg_hash, &entry->key, HASH_REMOVE, NULL);
+        file = NULL;
+        goto error;
     }
+
+    /*
+     * Rename file into place, so we atomically replace any old one.
+     */
+    if (rename(PGPG_DUMP_FILE ".tmp", PGPG_DUMP_FILE) != 0)
+        ereport(LOG,
+                (errcode_for_file_access(),
+                 errmsg("could not rename pg_plsql_graphs file \"%s\": %m",
+                        PGPG_DUMP_FILE ".tmp")));
+
+    return;
+
+error:
+    ereport(LOG,
+            (errcode_for_file_access(),
+             errmsg("could not write pg_plsql_graphs file \"%s\": %m",
+                    PGPG_DUMP_FILE ".tmp")));
+    if (file)
+        FreeFile(file);
+    unlink(PGPG_DUMP_FILE ".tmp");
 }
 
+
+/*
+ * Loads the entries saved by pgpg_save and the functions of the loaded
+ * entries into the function index. The file is mapped into memory, so the
+ * payloads are copied from the page cache to the storage directly.
+ * Loading stops at the first entry failing its checksum; entries beyond
+ * the limits of the hash table and the storage budget are skipped. The
+ * file is removed afterwards, so a crash does not load stale graphs.
+ *
+ * Called once by the postmaster while no other process is running, so no
+ * locks are needed.
+ */
+static void
+pgpg_load(void)
+{
+    int             fd;
+    struct stat     st;
+    char*           map;
+    char*           ptr;
+    char*           end;
+    uint32          header[3];
+    int32           num_entries;
+    int32           num_functions;
+    int32           loaded = 0;
+    bool            full = false;
+    pg_crc32c       crc;
+    pg_crc32c       fileCrc;
+
+    fd = OpenTransientFile(PGPG_DUMP_FILE, O_RDONLY | PG_BINARY, 0);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            ereport(LOG,
+                    (errcode_for_file_access(),
+                     errmsg("could not read pg_plsql_graphs file \"%s\": %m",
+                            PGPG_DUMP_FILE)));
+        return;
+    }
+
+    if (fstat(fd, &st) != 0 || (Size) st.st_size < sizeof(header) + sizeof(int32))
+    {
+        CloseTransientFile(fd);
+        goto discard;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    CloseTransientFile(fd);
+    if (map == MAP_FAILED)
+    {
+        ereport(LOG,
+                (errcode_for_file_access(),
+                 errmsg("could not map pg_plsql_graphs file \"%s\": %m",
+                        PGPG_DUMP_FILE)));
+        goto discard;
+    }
+
+    ptr = map;
+    end = map + st.st_size;
+
+    memcpy(header, ptr, sizeof(header));
+    ptr += sizeof(header);
+    memcpy(&num_entries, ptr, sizeof(int32));
+    ptr += sizeof(int32);
+
+    /* files of other versions are discarded silently */
+    if (header[0] != PGPG_FILE_HEADER ||
+        header[1] != PGPG_PG_MAJOR_VERSION ||
+        header[2] != GRAPH_IMAGE_MAGIC)
+        num_entries = 0;
+
+    for (int i = 0; i < num_entries; i++)
+    {
+        pgpgFileEntry   fentry;
+        pgpgEntry*      entry;
+        char*           name;
+        char*           data;
+        Size            nameSize;
+        Size            payloadSize;
+        Size            offset;
+
+        if ((Size) (end - ptr) < sizeof(fentry))
+            break;
+        memcpy(&fentry, ptr, sizeof(fentry));
+        ptr += sizeof(fentry);
+
+        if (fentry.nameLen < 0 || fentry.storedSize < 0 ||
+            (Size) (end - ptr) < (Size) fentry.nameLen + 1 +
+                        (fentry.truncated ? 0 : fentry.storedSize) +
+                        sizeof(pg_crc32c))
+            break;
+        name = ptr;
+        ptr += fentry.nameLen + 1;
+        data = ptr;
+        if (!fentry.truncated)
+            ptr += fentry.storedSize;
+        memcpy(&fileCrc, ptr, sizeof(pg_crc32c));
+        ptr += sizeof(pg_crc32c);
+
+        INIT_CRC32C(crc);
+        COMP_CRC32C(crc, &fentry, sizeof(fentry));
+        COMP_CRC32C(crc, name, fentry.nameLen + 1);
+        if (!fentry.truncated)
+            COMP_CRC32C(crc, data, fentry.storedSize);
+        FIN_CRC32C(crc);
+
+        if (!EQ_CRC32C(crc, fileCrc) || name[fentry.nameLen] != '\0')
+        {
+            ereport(LOG,
+                    (errmsg("pg_plsql_graphs file \"%s\" is corrupt, %d of %d graphs loaded",
+                            PGPG_DUMP_FILE, loaded, num_entries)));
+            goto unmap;
+        }
+
+        if (full || hash_search(pgpg_hash, &fentry.key, HASH_FIND, NULL))
+            continue;
+
+        /* keep the limits of the running server, the rest is only read past */
+        nameSize = MAXALIGN(fentry.nameLen + 1);
+        payloadSize = nameSize + (fentry.truncated ? 0 : MAXALIGN(fentry.storedSize));
+        if (hash_get_num_entries(pgpg_hash) >= pgpg_max ||
+            !storage_reserve(payloadSize, &offset))
+        {
+            full = true;
+            continue;
+        }
+
+        entry = (pgpgEntry *) hash_search(pgpg_hash, &fentry.key, HASH_ENTER, NULL);
+
+        entry->counters = fentry.counters;
+        SpinLockInit(&entry->mutex);
+
+        memset(&entry->graph, 0, sizeof(GraphStruct));
+        entry->graph.id = graph_id_make(pgpg->counter++, &entry->key);
+        id_index_set(entry);
+        entry->graph.offset = offset;
+        entry->graph.payloadSize = payloadSize;
+        entry->graph.nameLen = fentry.nameLen;
+        entry->graph.imageSize = fentry.imageSize;
+        entry->graph.storedSize = fentry.storedSize;
+        entry->graph.buildMemory = fentry.buildMemory;
+        entry->graph.compressed = fentry.compressed;
+        entry->graph.truncated = fentry.truncated;
+        memcpy(entry_function_name(entry), name, fentry.nameLen + 1);
+        if (!fentry.truncated)
+            memcpy(entry_image_data(entry), data, fentry.storedSize);
+
+        loaded++;
+    }
+
+    /* the function index, only functions of loaded entries are kept */
+    if (num_entries > 0 && (Size) (end - ptr) >= sizeof(int32))
+    {
+        memcpy(&num_functions, ptr, sizeof(int32));
+        ptr += sizeof(int32);
+
+        if (num_functions >= 0 &&
+            (Size) (end - ptr) >= (Size) num_functions * sizeof(pgpgFunctionEntry) +
+                                  sizeof(pg_crc32c))
+        {
+            INIT_CRC32C(crc);
+            COMP_CRC32C(crc, ptr, (Size) num_functions * sizeof(pgpgFunctionEntry));
+            FIN_CRC32C(crc);
+            memcpy(&fileCrc, ptr + (Size) num_functions * sizeof(pgpgFunctionEntry),
+                   sizeof(pg_crc32c));
+
+            for (int i = 0; EQ_CRC32C(crc, fileCrc) && i < num_functions; i++)
+            {
+                pgpgFunctionEntry   saved;
+                pgpgFunctionEntry*  fentry;
+
+                memcpy(&saved, ptr + (Size) i * sizeof(pgpgFunctionEntry),
+                       sizeof(pgpgFunctionEntry));
+                if (!hash_search(pgpg_hash, &saved.entrykey, HASH_FIND, NULL) ||
+                    !index_reserve_slot())
+                    continue;
+
+                fentry = (pgpgFunctionEntry *) hash_search(pgpg_function_index,
+                                                           &saved.key,
+                                                           HASH_ENTER_NULL, NULL);
+                if (fentry)
+                    fentry->entrykey = saved.entrykey;
+                else
+                    pg_atomic_fetch_sub_u32(&pgpg->nindexed, 1);
+            }
+        }
+    }
+
+unmap:
+    munmap(map, st.st_size);
+
+discard:
+    /*
+     * Remove the file so it's not included in backups/replication slaves,
+     * etc. A new file will be written on next shutdown.
+     */
+    unlink(PGPG_DUMP_FILE);
+}
@@ -1,13 +1,12 @@
 #include "plpgsql.h"
 #include "nodes/pg_list.h"
+#include "datatype/timestamp.h"
+#include "storage/itemptr.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <igraph/igraph.h>
 
 
-#define MAXDOTFILESIZE 4096
-
 #define eos(s) ((s)+strlen(s))
 
 
@@ -21,6 +20,23 @@
  * Functions in pg_plsql_graphs.c
  * ----------
  */
-void createGraph(PLpgSQL_function* function,PLpgSQL_execstate *estate);
+void createGraph(PLpgSQL_function* function,PLpgSQL_execstate *estate,bool rebuild);
+void createRequestedGraph(PLpgSQL_function* function,
+                          Oid               userid,
+                          Oid               dbid,
+                          int               pid,
+                          TimestampTz       called);
+void pgpg_reserve_entries(void);
+
+/* ----------
+ * Functions in pg_plsql_graphs_worker.c
+ * ----------
+ */
+extern int pgpg_max_workers;
+extern int pgpg_queue_size;
+
+Size pgpg_worker_shmem_size(void);
+void pgpg_worker_shmem_startup(void);
+bool pgpg_worker_enqueue(Oid functionid, TransactionId fn_xmin, ItemPointer fn_tid);
 
 
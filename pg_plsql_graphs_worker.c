@@ -0,0 +1,615 @@
+#include "postgres.h"
+#include "plpgsql.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "catalog/pg_proc.h"
+#include "catalog/pg_type.h"
+#include "commands/event_trigger.h"
+#include "commands/trigger.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+#include "pg_plsql_graphs.h"
+
+
+/* ms a worker waits for new requests before it exits */
+#define PGPG_WORKER_IDLE_TIMEOUT 10000L
+
+
+/*
+ * A request to build the graphs of a function version
+ */
+typedef struct pgpgRequest
+{
+    bool            used;           /* slot holds a request */
+    Oid             dbid;           /* database OID of the caller */
+    Oid             userid;         /* user OID of the caller */
+    int             pid;            /* process ID of the caller */
+    Oid             functionid;     /* function OID */
+    TransactionId   fn_xmin;        /* xmin of the pg_proc row */
+    ItemPointerData fn_tid;         /* tid of the pg_proc row */
+    TimestampTz     called;         /* time of the requesting call */
+} pgpgRequest;
+
+/*
+ * A background worker building the graphs of one database
+ */
+typedef struct pgpgWorkerSlot
+{
+    bool            used;           /* a worker is started for dbid */
+    Oid             dbid;           /* database the worker is connected to */
+    Latch*          latch;          /* latch of the worker, NULL while starting */
+    uint32          generation;     /* incremented whenever the slot is taken */
+} pgpgWorkerSlot;
+
+/*
+ * Shared state of the request queue and the workers.
+ * The arrays of requests and worker slots follow the struct.
+ */
+typedef struct pgpgWorkerState
+{
+    LWLock*         lock;           /* protects the whole struct */
+    int             nrequests;      /* # of used request slots */
+    int64           dropped;        /* # of requests dropped on a full queue */
+    pgpgWorkerSlot* workers;        /* pgpg_max_workers worker slots */
+    pgpgRequest*    requests;       /* pgpg_queue_size request slots */
+} pgpgWorkerState;
+
+
+/* plpgsql_compile of the plpgsql library */
+typedef PLpgSQL_function* (*plpgsql_compile_t)(FunctionCallInfo fcinfo, bool forValidator);
+
+
+void        pgpg_worker_main(Datum main_arg);
+
+static void pgpg_worker_sigterm(SIGNAL_ARGS);
+static void pgpg_worker_exit(int code, Datum arg);
+static bool launch_worker(Oid dbid);
+static bool worker_never_started(int slot);
+static void launch_waiting_workers(void);
+static bool dequeue_request(Oid dbid, pgpgRequest* request);
+static bool release_worker_slot(int slot);
+static void process_request(pgpgRequest* request);
+static PLpgSQL_function* compile_function(HeapTuple procTup);
+static bool is_requested_version(HeapTuple procTup, pgpgRequest* request);
+
+
+int     pgpg_max_workers = 2;       /* max # of background workers */
+int     pgpg_queue_size = 256;      /* max # of queued requests */
+
+/* Link to shared memory state */
+static pgpgWorkerState* pgpg_worker = NULL;
+
+/* flag set by the SIGTERM handler of a worker */
+static volatile sig_atomic_t got_sigterm = false;
+
+/* plpgsql_compile, looked up when a worker starts */
+static plpgsql_compile_t plpgsql_compile_fn = NULL;
+
+/* generation of its slot when a worker started */
+static uint32 my_generation = 0;
+
+/*
+ * Handles of the workers this backend registered and the generations of
+ * their slots, the only way to find out that a worker never started
+ */
+static BackgroundWorkerHandle** launched_handles = NULL;
+static uint32* launched_generations = NULL;
+
+
+/**
+ * Size of the shared memory needed by the queue and the workers
+ */
+Size pgpg_worker_shmem_size(void){
+    Size size = MAXALIGN(sizeof(pgpgWorkerState));
+
+    size = add_size(size, MAXALIGN(mul_size(pgpg_max_workers, sizeof(pgpgWorkerSlot))));
+    size = add_size(size, mul_size(pgpg_queue_size, sizeof(pgpgRequest)));
+    return size;
+}
+
+/**
+ * Allocates the queue and the worker slots in shared memory.
+ * Caller must hold AddinShmemInitLock.
+ */
+void pgpg_worker_shmem_startup(void){
+    bool found;
+
+    pgpg_worker = ShmemInitStruct("pgpgWorkerState",
+                                  pgpg_worker_shmem_size(),
+                                  &found);
+
+    if(!found){
+        char* ptr = (char*) pgpg_worker;
+
+        memset(pgpg_worker, 0, pgpg_worker_shmem_size());
+
+        pgpg_worker->lock = LWLockAssign();
+
+        ptr += MAXALIGN(sizeof(pgpgWorkerState));
+        pgpg_worker->workers = (pgpgWorkerSlot*) ptr;
+        ptr += MAXALIGN(mul_size(pgpg_max_workers, sizeof(pgpgWorkerSlot)));
+        pgpg_worker->requests = (pgpgRequest*) ptr;
+    }
+}
+
+
+/**
+ * Queues a request to build the graphs of the given function version in
+ * the background. Starts a worker for the current database if there is
+ * none. Returns false if the request was dropped because the queue is full.
+ */
+bool pgpg_worker_enqueue(Oid functionid, TransactionId fn_xmin, ItemPointer fn_tid){
+    pgpgRequest*    request = NULL;
+    Latch*          latch = NULL;
+    int             starting = -1;
+    bool            running = false;
+
+    if(!pgpg_worker)
+        return false;
+
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+
+    /* find a free slot */
+    if(pgpg_worker->nrequests < pgpg_queue_size){
+        for(int i=0;i<pgpg_queue_size;i++){
+            if(!pgpg_worker->requests[i].used){
+                request = &pgpg_worker->requests[i];
+                break;
+            }
+        }
+    }
+
+    if(request == NULL){
+        /* queue is full, drop the request */
+        pgpg_worker->dropped++;
+        LWLockRelease(pgpg_worker->lock);
+        return false;
+    }
+
+    request->used = true;
+    request->dbid = MyDatabaseId;
+    request->userid = GetUserId();
+    request->pid = MyProcPid;
+    request->functionid = functionid;
+    request->fn_xmin = fn_xmin;
+    request->fn_tid = *fn_tid;
+    request->called = GetCurrentStatementStartTimestamp();
+    pgpg_worker->nrequests++;
+
+    /* look for the worker of the current database */
+    for(int i=0;i<pgpg_max_workers;i++){
+        if(pgpg_worker->workers[i].used && pgpg_worker->workers[i].dbid == MyDatabaseId){
+            latch = pgpg_worker->workers[i].latch;
+            running = true;
+            if(latch == NULL)
+                starting = i;
+            break;
+        }
+    }
+
+    LWLockRelease(pgpg_worker->lock);
+
+    /* a worker registered by us may have failed to start, replace it */
+    if(starting >= 0 && worker_never_started(starting))
+        running = false;
+
+    /* wake up the worker, or start one */
+    if(latch)
+        SetLatch(latch);
+    else if(!running)
+        launch_worker(MyDatabaseId);
+
+    return true;
+}
+
+
+/**
+ * Registers a dynamic background worker for the given database if there
+ * is a free worker slot. Otherwise the requests of the database wait
+ * until a slot is released.
+ */
+static bool launch_worker(Oid dbid){
+    BackgroundWorker        worker;
+    BackgroundWorkerHandle* handle;
+    MemoryContext           oldcontext;
+    uint32                  generation = 0;
+    int                     slot = -1;
+
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+    for(int i=0;i<pgpg_max_workers;i++){
+        /* another backend may have started a worker meanwhile */
+        if(pgpg_worker->workers[i].used && pgpg_worker->workers[i].dbid == dbid){
+            slot = -1;
+            break;
+        }
+        if(!pgpg_worker->workers[i].used && slot < 0)
+            slot = i;
+    }
+    if(slot >= 0){
+        pgpg_worker->workers[slot].used = true;
+        pgpg_worker->workers[slot].dbid = dbid;
+        pgpg_worker->workers[slot].latch = NULL;
+        generation = ++pgpg_worker->workers[slot].generation;
+    }
+    LWLockRelease(pgpg_worker->lock);
+
+    if(slot < 0)
+        return false;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = BGW_NEVER_RESTART;
+    worker.bgw_main = NULL;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "pg_plsql_graphs");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN, "pgpg_worker_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "pg_plsql_graphs worker for database %u", dbid);
+    worker.bgw_main_arg = Int32GetDatum(slot);
+    worker.bgw_notify_pid = 0;
+
+    /* the handle is kept to check later whether the worker started */
+    oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+    if(launched_handles == NULL){
+        launched_handles = palloc0(pgpg_max_workers * sizeof(BackgroundWorkerHandle*));
+        launched_generations = palloc0(pgpg_max_workers * sizeof(uint32));
+    }
+
+    if(!RegisterDynamicBackgroundWorker(&worker, &handle)){
+        MemoryContextSwitchTo(oldcontext);
+
+        /* no background worker available, give the slot back */
+        LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+        if(pgpg_worker->workers[slot].generation == generation)
+            pgpg_worker->workers[slot].used = false;
+        LWLockRelease(pgpg_worker->lock);
+        return false;
+    }
+    MemoryContextSwitchTo(oldcontext);
+
+    if(launched_handles[slot] != NULL)
+        pfree(launched_handles[slot]);
+    launched_handles[slot] = handle;
+    launched_generations[slot] = generation;
+    return true;
+}
+
+
+/**
+ * Checks whether the starting worker of a slot was registered by this
+ * backend and stopped before it announced itself. Such a worker never
+ * ran its exit callback, its slot is released here. Returns true if the
+ * slot was released.
+ */
+static bool worker_never_started(int slot){
+    pid_t   pid;
+    Oid     dbid = InvalidOid;
+    bool    released = false;
+
+    if(launched_handles == NULL || launched_handles[slot] == NULL)
+        return false;
+
+    if(GetBackgroundWorkerPid(launched_handles[slot], &pid) != BGWH_STOPPED)
+        return false;
+
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+    if(pgpg_worker->workers[slot].used &&
+       pgpg_worker->workers[slot].latch == NULL &&
+       pgpg_worker->workers[slot].generation == launched_generations[slot]){
+        pgpg_worker->workers[slot].used = false;
+        dbid = pgpg_worker->workers[slot].dbid;
+        released = true;
+    }
+    LWLockRelease(pgpg_worker->lock);
+
+    pfree(launched_handles[slot]);
+    launched_handles[slot] = NULL;
+
+    if(released)
+        elog(LOG, "pg_plsql_graphs: background worker for database %u did not start", dbid);
+    return released;
+}
+
+
+/**
+ * Starts workers for the databases with queued requests but no worker,
+ * as long as there are free worker slots
+ */
+static void launch_waiting_workers(void){
+    for(;;){
+        Oid dbid = InvalidOid;
+
+        LWLockAcquire(pgpg_worker->lock, LW_SHARED);
+        for(int i=0;i<pgpg_queue_size && !OidIsValid(dbid);i++){
+            bool running = false;
+
+            if(!pgpg_worker->requests[i].used)
+                continue;
+            for(int w=0;w<pgpg_max_workers && !running;w++)
+                running = pgpg_worker->workers[w].used &&
+                          pgpg_worker->workers[w].dbid == pgpg_worker->requests[i].dbid;
+            if(!running)
+                dbid = pgpg_worker->requests[i].dbid;
+        }
+        LWLockRelease(pgpg_worker->lock);
+
+        if(!OidIsValid(dbid) || !launch_worker(dbid))
+            return;
+    }
+}
+
+
+/**
+ * Takes the next request of the given database from the queue
+ */
+static bool dequeue_request(Oid dbid, pgpgRequest* request){
+    bool found = false;
+
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+    for(int i=0;i<pgpg_queue_size && pgpg_worker->nrequests > 0;i++){
+        if(pgpg_worker->requests[i].used && pgpg_worker->requests[i].dbid == dbid){
+            *request = pgpg_worker->requests[i];
+            pgpg_worker->requests[i].used = false;
+            pgpg_worker->nrequests--;
+            found = true;
+            break;
+        }
+    }
+    LWLockRelease(pgpg_worker->lock);
+
+    return found;
+}
+
+
+/**
+ * Releases the slot of an idle worker. Returns false if new requests
+ * for its database arrived in the meantime, the worker must go on then.
+ */
+static bool release_worker_slot(int slot){
+    Oid  dbid = pgpg_worker->workers[slot].dbid;
+    bool pending = false;
+
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+    for(int i=0;i<pgpg_queue_size && pgpg_worker->nrequests > 0;i++){
+        if(pgpg_worker->requests[i].used && pgpg_worker->requests[i].dbid == dbid){
+            pending = true;
+            break;
+        }
+    }
+    if(!pending){
+        pgpg_worker->workers[slot].used = false;
+        pgpg_worker->workers[slot].latch = NULL;
+    }
+    LWLockRelease(pgpg_worker->lock);
+
+    return !pending;
+}
+
+
+/**
+ * SIGTERM handler of the worker
+ */
+static void pgpg_worker_sigterm(SIGNAL_ARGS){
+    int save_errno = errno;
+
+    got_sigterm = true;
+    if(MyProc)
+        SetLatch(&MyProc->procLatch);
+
+    errno = save_errno;
+}
+
+
+/**
+ * Exit callback of the worker. Gives its slot back however the worker
+ * ends and starts workers for requests that are still queued. The
+ * requests of a database whose worker failed are dropped, they are
+ * repeated by later calls.
+ */
+static void pgpg_worker_exit(int code, Datum arg){
+    int     slot = DatumGetInt32(arg);
+    Oid     dbid;
+
+    /* errors may have left the lock held */
+    LWLockReleaseAll();
+
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+    dbid = pgpg_worker->workers[slot].dbid;
+    if(pgpg_worker->workers[slot].used &&
+       pgpg_worker->workers[slot].generation == my_generation){
+        pgpg_worker->workers[slot].used = false;
+        pgpg_worker->workers[slot].latch = NULL;
+    }
+    if(code != 0){
+        for(int i=0;i<pgpg_queue_size && pgpg_worker->nrequests > 0;i++){
+            if(pgpg_worker->requests[i].used && pgpg_worker->requests[i].dbid == dbid){
+                pgpg_worker->requests[i].used = false;
+                pgpg_worker->nrequests--;
+            }
+        }
+    }
+    LWLockRelease(pgpg_worker->lock);
+
+    /* the slot may be the one queued requests of another database wait for */
+    if(!got_sigterm)
+        launch_waiting_workers();
+}
+
+
+/**
+ * Main function of a background worker. It builds the graphs of the
+ * requested functions of one database until it is idle for a while.
+ */
+void pgpg_worker_main(Datum main_arg){
+    int             slot = DatumGetInt32(main_arg);
+    Oid             dbid;
+    MemoryContext   workerContext;
+
+    LWLockAcquire(pgpg_worker->lock, LW_SHARED);
+    dbid = pgpg_worker->workers[slot].dbid;
+    my_generation = pgpg_worker->workers[slot].generation;
+    LWLockRelease(pgpg_worker->lock);
+
+    /* the slot is released whatever ends the worker from here on */
+    before_shmem_exit(pgpg_worker_exit, Int32GetDatum(slot));
+
+    pqsignal(SIGTERM, pgpg_worker_sigterm);
+    BackgroundWorkerUnblockSignals();
+
+    BackgroundWorkerInitializeConnectionByOid(dbid, InvalidOid);
+
+    /* plpgsql is not linked to us, look up its compiler */
+    plpgsql_compile_fn = (plpgsql_compile_t)
+            load_external_function("$libdir/plpgsql", "plpgsql_compile", true, NULL);
+
+    workerContext = AllocSetContextCreate(TopMemoryContext,
+                                          "pg_plsql_graphs worker",
+                                          ALLOCSET_DEFAULT_MINSIZE,
+                                          ALLOCSET_DEFAULT_INITSIZE,
+                                          ALLOCSET_DEFAULT_MAXSIZE);
+
+    /* requests can be announced from now on */
+    LWLockAcquire(pgpg_worker->lock, LW_EXCLUSIVE);
+    pgpg_worker->workers[slot].latch = &MyProc->procLatch;
+    LWLockRelease(pgpg_worker->lock);
+
+    while(!got_sigterm){
+        pgpgRequest request;
+        int         rc;
+
+        if(dequeue_request(dbid,&request)){
+            MemoryContextSwitchTo(workerContext);
+            process_request(&request);
+            MemoryContextReset(workerContext);
+            continue;
+        }
+
+        rc = WaitLatch(&MyProc->procLatch,
+                       WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+                       PGPG_WORKER_IDLE_TIMEOUT);
+        ResetLatch(&MyProc->procLatch);
+
+        if(rc & WL_POSTMASTER_DEATH)
+            proc_exit(1);
+
+        /* nothing to do for a while, stop unless requests arrived meanwhile */
+        if((rc & WL_TIMEOUT) && release_worker_slot(slot))
+            proc_exit(0);
+    }
+
+    /* asked to stop, the exit callback releases the slot */
+    proc_exit(0);
+}
+
+
+/**
+ * Compiles the requested function and builds its graphs in an own
+ * transaction. Errors are reported and do not stop the worker.
+ */
+static void process_request(pgpgRequest* request){
+    MemoryContext   requestContext = CurrentMemoryContext;
+
+    StartTransactionCommand();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, "building pg_plsql_graphs");
+
+    PG_TRY();
+    {
+        HeapTuple procTup;
+
+        /* evict here rather than in the backends that store graphs */
+        pgpg_reserve_entries();
+
+        procTup = SearchSysCache1(PROCOID, ObjectIdGetDatum(request->functionid));
+
+        /*
+         * The function may have been dropped or replaced meanwhile. A newer
+         * version is not built here, its own calls request it.
+         */
+        if(HeapTupleIsValid(procTup) && !is_requested_version(procTup,request)){
+            elog(DEBUG1, "pg_plsql_graphs: function %u changed since it was requested, skipped",
+                 request->functionid);
+            ReleaseSysCache(procTup);
+        }
+        else if(HeapTupleIsValid(procTup)){
+            PLpgSQL_function* function = compile_function(procTup);
+
+            ReleaseSysCache(procTup);
+
+            createRequestedGraph(function,
+                                 request->userid,
+                                 request->dbid,
+                                 request->pid,
+                                 request->called);
+        }
+
+        PopActiveSnapshot();
+        CommitTransactionCommand();
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(requestContext);
+        EmitErrorReport();
+        FlushErrorState();
+        AbortCurrentTransaction();
+    }
+    PG_END_TRY();
+
+    MemoryContextSwitchTo(requestContext);
+    pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+
+/**
+ * Checks that the pg_proc row is the version of the function the request
+ * was made for, the way plpgsql checks its cached functions
+ */
+static bool is_requested_version(HeapTuple procTup, pgpgRequest* request){
+    return request->fn_xmin == HeapTupleHeaderGetRawXmin(procTup->t_data) &&
+           ItemPointerEquals(&request->fn_tid, &procTup->t_self);
+}
+
+
+/**
+ * Compiles a plpgsql function like the plpgsql validator does, i.e.
+ * without a real call. Trigger functions get a fake trigger context.
+ */
+static PLpgSQL_function* compile_function(HeapTuple procTup){
+    Form_pg_proc            proc = (Form_pg_proc) GETSTRUCT(procTup);
+    FunctionCallInfoData    fake_fcinfo;
+    FmgrInfo                flinfo;
+    TriggerData             trigdata;
+    EventTriggerData        etrigdata;
+
+    MemSet(&fake_fcinfo, 0, sizeof(fake_fcinfo));
+    MemSet(&flinfo, 0, sizeof(flinfo));
+    fake_fcinfo.flinfo = &flinfo;
+    flinfo.fn_oid = HeapTupleGetOid(procTup);
+    flinfo.fn_mcxt = CurrentMemoryContext;
+
+    if(proc->prorettype == TRIGGEROID ||
+       (proc->prorettype == OPAQUEOID && proc->pronargs == 0)){
+        MemSet(&trigdata, 0, sizeof(trigdata));
+        trigdata.type = T_TriggerData;
+        fake_fcinfo.context = (Node *) &trigdata;
+    }
+    else if(proc->prorettype == EVTTRIGGEROID){
+        MemSet(&etrigdata, 0, sizeof(etrigdata));
+        etrigdata.type = T_EventTriggerData;
+        fake_fcinfo.context = (Node *) &etrigdata;
+    }
+
+    return plpgsql_compile_fn(&fake_fcinfo, true);
+}
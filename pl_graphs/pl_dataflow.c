@@ -0,0 +1,347 @@
+#include "plpgsql.h"
+#include "nodes/pg_list.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pl_graphs.h"
+
+
+/*
+ * Bit-vector dataflow analysis over the flow graph.
+ *
+ * The definitions (a node writing a variable) and uses (a node reading a
+ * variable) are numbered by their position in the writer and reader lists
+ * of the variable index of the graph, so the items of one variable are
+ * contiguous, and sets of them are kept as packed bit vectors. Two forward analyses
+ * are solved one strongly connected component of the flow graph after the
+ * other, in topological order. The predecessors outside a component are
+ * final when it is solved, so only components with a loop are iterated
+ * until nothing changes, all others take a single pass:
+ *
+ *  - reaching definitions, giving the WR and WW dependences of a node on
+ *    the definitions that reach it
+ *  - reaching uses, giving the RW dependences of a node on the uses that
+ *    reach it without an intervening write of their variable
+ *
+ * A write kills all items of its variable, so only the nearest
+ * definitions and uses become dependences. Only variables
+ * (PLPGSQL_DTYPE_VAR) are tracked.
+ */
+
+typedef uint64 bitword;
+
+#define BITS_PER_BITWORD    64
+#define BITWORDNUM(x)       ((x) / BITS_PER_BITWORD)
+#define BITNUM(x)           ((x) % BITS_PER_BITWORD)
+#define BITWORDS(n)         (((n) + BITS_PER_BITWORD - 1) / BITS_PER_BITWORD)
+
+
+/**
+ * Definitions or uses of the variables in the graph. Item i is the
+ * node nodes[i], the items of datum dno are start[dno]..start[dno+1]-1.
+ */
+typedef struct DataflowItems{
+    int         nitems;         /* # of items */
+    int*        start;          /* items per datum, from the variable index */
+    int*        nodes;          /* node per item, from the variable index */
+    int*        itemDno;        /* datum per item */
+    int*        nodeStart;      /* tracked items of node n are nodeItems[nodeStart[n]..nodeStart[n+1]-1] */
+    int*        nodeItems;
+    int         nwords;         /* words per item bit vector */
+    bitword*    out;            /* items reaching the end of each node */
+} DataflowItems;
+
+
+/**
+ * The flow graph in the shape the solver needs it
+ */
+typedef struct DataflowGraph{
+    int         nnodes;         /* # of nodes */
+    bool*       tracked;        /* per dno, true for variables */
+    GraphReachability* reach;   /* components of the flow graph */
+    int*        predStart;      /* flow predecessors of node n are preds[predStart[n]..predStart[n+1]-1] */
+    int*        preds;
+} DataflowGraph;
+
+
+static inline int rightmostBit(bitword word){
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int pos = 0;
+    while(!(word & 1)){
+        word >>= 1;
+        pos++;
+    }
+    return pos;
+#endif
+}
+
+
+/**
+ * Marks the datums that are tracked
+ */
+static void initVariables(DataflowGraph* dfg, PLGraph* graph){
+    dfg->tracked = palloc(Max(graph->ndatums,1) * sizeof(bool));
+
+    for(int dno=0;dno<graph->ndatums;dno++)
+        dfg->tracked[dno] = graph->datums[dno]->dtype == PLPGSQL_DTYPE_VAR;
+}
+
+
+/**
+ * Collects the flow predecessors of the nodes and their components
+ */
+static void initFlow(DataflowGraph* dfg, PLGraph* graph){
+    int     nnodes = graph->nnodes;
+    int*    next = palloc(Max(nnodes,1) * sizeof(int));
+
+    dfg->nnodes = nnodes;
+
+    /* predecessors over flow edges, as CSR */
+    dfg->predStart = palloc0((nnodes + 1) * sizeof(int));
+    for(int eid=0;eid<graph->nedges;eid++){
+        if(graph->edgeKind[eid] == EDGE_FLOW)
+            dfg->predStart[graph->edgeTo[eid] + 1]++;
+    }
+    for(int nodeid=0;nodeid<nnodes;nodeid++){
+        dfg->predStart[nodeid + 1] += dfg->predStart[nodeid];
+    }
+    dfg->preds = palloc(Max(dfg->predStart[nnodes],1) * sizeof(int));
+    memcpy(next, dfg->predStart, nnodes * sizeof(int));
+    for(int eid=0;eid<graph->nedges;eid++){
+        if(graph->edgeKind[eid] == EDGE_FLOW)
+            dfg->preds[next[graph->edgeTo[eid]]++] = graph->edgeFrom[eid];
+    }
+
+    /* the components are kept with the graph, only their order is needed */
+    if(graph->reach == NULL)
+        graph->reach = computeFlowReachability(graph,false);
+    dfg->reach = graph->reach;
+
+    pfree(next);
+}
+
+
+/**
+ * Sets up the definitions or uses given by the writer or reader lists of
+ * the variable index
+ */
+static void initItems(DataflowItems* items, DataflowGraph* dfg, int ndatums, int* start, int* nodes){
+    int nnodes = dfg->nnodes;
+    int* next;
+
+    items->nitems = start[ndatums];
+    items->start = start;
+    items->nodes = nodes;
+    items->itemDno = palloc(Max(items->nitems,1) * sizeof(int));
+    items->nodeStart = palloc0((nnodes + 1) * sizeof(int));
+    items->nodeItems = palloc(Max(items->nitems,1) * sizeof(int));
+    items->nwords = BITWORDS(items->nitems);
+    items->out = palloc0(Max((Size) nnodes * items->nwords,1) * sizeof(bitword));
+
+    /* the tracked items per node */
+    for(int dno=0;dno<ndatums;dno++){
+        for(int it=start[dno];it<start[dno + 1];it++){
+            items->itemDno[it] = dno;
+            if(dfg->tracked[dno])
+                items->nodeStart[nodes[it] + 1]++;
+        }
+    }
+    for(int nodeid=0;nodeid<nnodes;nodeid++)
+        items->nodeStart[nodeid + 1] += items->nodeStart[nodeid];
+
+    next = palloc(Max(nnodes,1) * sizeof(int));
+    memcpy(next, items->nodeStart, nnodes * sizeof(int));
+    for(int it=0;it<items->nitems;it++){
+        if(dfg->tracked[items->itemDno[it]])
+            items->nodeItems[next[nodes[it]]++] = it;
+    }
+    pfree(next);
+}
+
+
+/**
+ * Clears the bits start..end-1
+ */
+static inline void clearRange(bitword* bits, int start, int end){
+    for(int i=start;i<end;){
+        if(BITNUM(i) == 0 && i + BITS_PER_BITWORD <= end){
+            bits[BITWORDNUM(i)] = 0;
+            i += BITS_PER_BITWORD;
+        }
+        else{
+            bits[BITWORDNUM(i)] &= ~(((bitword) 1) << BITNUM(i));
+            i++;
+        }
+    }
+}
+
+
+/**
+ * Unites the out sets of the predecessors of a node into in
+ */
+static void unionPredecessors(bitword* in, DataflowItems* items, DataflowGraph* dfg, int nodeid){
+    int nwords = items->nwords;
+
+    memset(in, 0, nwords * sizeof(bitword));
+    for(int p=dfg->predStart[nodeid];p<dfg->predStart[nodeid + 1];p++){
+        bitword* out = items->out + (Size) dfg->preds[p] * nwords;
+
+        for(int w=0;w<nwords;w++)
+            in[w] |= out[w];
+    }
+}
+
+
+/**
+ * Solves a forward may analysis of the given items. A node kills all
+ * items of the variables it writes and generates its own items. Its own
+ * items survive its writes: a node reads before it writes, so its reads
+ * still reach the next write of the variable.
+ */
+static void solveReaching(DataflowItems* items, DataflowItems* defs, DataflowGraph* dfg){
+    GraphReachability* reach = dfg->reach;
+    int         nwords = items->nwords;
+    bitword*    in = palloc(Max(nwords,1) * sizeof(bitword));
+    bitword*    out = palloc(Max(nwords,1) * sizeof(bitword));
+
+    if(items->nitems == 0){
+        pfree(in);
+        pfree(out);
+        return;
+    }
+
+    /* components are numbered in reverse topological order */
+    for(int c=reach->ncomponents - 1;c>=0;c--){
+        bool changed;
+
+        do{
+            changed = false;
+
+            for(int m=reach->memberStart[c];m<reach->memberStart[c + 1];m++){
+                int nodeid = reach->members[m];
+                bitword* nodeOut = items->out + (Size) nodeid * nwords;
+
+                unionPredecessors(in, items, dfg, nodeid);
+                memcpy(out, in, nwords * sizeof(bitword));
+
+                /* kill the items of the variables the node writes */
+                for(int d=defs->nodeStart[nodeid];d<defs->nodeStart[nodeid + 1];d++){
+                    int dno = defs->itemDno[defs->nodeItems[d]];
+
+                    clearRange(out, items->start[dno], items->start[dno + 1]);
+                }
+
+                /* generate the own items */
+                for(int i=items->nodeStart[nodeid];i<items->nodeStart[nodeid + 1];i++){
+                    int it = items->nodeItems[i];
+                    out[BITWORDNUM(it)] |= ((bitword) 1) << BITNUM(it);
+                }
+
+                if(memcmp(out, nodeOut, nwords * sizeof(bitword)) != 0){
+                    memcpy(nodeOut, out, nwords * sizeof(bitword));
+                    changed = true;
+                }
+            }
+        }while(changed && reach->cyclic[c]);
+    }
+
+    pfree(in);
+    pfree(out);
+}
+
+
+/**
+ * Adds an edge from every node that has an item of the given datum in the
+ * in set to the given node. Only the writers or readers of the datum
+ * are visited. mark remembers the last target per source so that an
+ * edge is added only once.
+ */
+static void addReachingEdges(PLGraph* graph, int nodeid, bitword* in, DataflowItems* items, int dno, GraphEdgeKind kind, int* mark){
+
+    for(int it=items->start[dno];it<items->start[dno + 1];it++){
+        int from;
+
+        /* skip empty words */
+        if(in[BITWORDNUM(it)] == 0){
+            it |= BITS_PER_BITWORD - 1;
+            continue;
+        }
+        if(!((in[BITWORDNUM(it)] >> BITNUM(it)) & 1))
+            continue;
+
+        from = items->nodes[it];
+        if(from != nodeid && mark[from] != nodeid){
+            mark[from] = nodeid;
+            addGraphEdge(graph,from,nodeid,kind);
+        }
+    }
+}
+
+
+/**
+ * Adds the WR, WW and RW dependence edges of the graph as found by the
+ * reaching definitions and reaching uses analyses
+ */
+void addDataflowDependenceEdges(PLGraph* graph){
+    DataflowGraph   dfg;
+    DataflowItems   defs;
+    DataflowItems   uses;
+    bitword*        inDefs;
+    bitword*        inUses;
+    int*            mark[NUM_EDGE_KINDS];
+
+    if(graph->nnodes == 0)
+        return;
+
+    if(graph->writerStart == NULL)
+        buildVariableIndex(graph);
+
+    initVariables(&dfg,graph);
+    initFlow(&dfg,graph);
+    initItems(&defs,&dfg,graph->ndatums,graph->writerStart,graph->writers);
+    initItems(&uses,&dfg,graph->ndatums,graph->readerStart,graph->readers);
+
+    solveReaching(&defs,&defs,&dfg);
+    solveReaching(&uses,&defs,&dfg);
+
+    inDefs = palloc(Max(defs.nwords,1) * sizeof(bitword));
+    inUses = palloc(Max(uses.nwords,1) * sizeof(bitword));
+    for(int kind=0;kind<NUM_EDGE_KINDS;kind++){
+        mark[kind] = palloc(graph->nnodes * sizeof(int));
+        memset(mark[kind], -1, graph->nnodes * sizeof(int));
+    }
+
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
+
+        /* nodes without items can not depend on anything */
+        if(defs.nodeStart[nodeid] == defs.nodeStart[nodeid + 1] &&
+           uses.nodeStart[nodeid] == uses.nodeStart[nodeid + 1])
+            continue;
+
+        unionPredecessors(inDefs,&defs,&dfg,nodeid);
+        unionPredecessors(inUses,&uses,&dfg,nodeid);
+
+        /* definitions reaching a read */
+        for(int u=uses.nodeStart[nodeid];u<uses.nodeStart[nodeid + 1];u++){
+            int dno = uses.itemDno[uses.nodeItems[u]];
+            addReachingEdges(graph,nodeid,inDefs,&defs,dno,EDGE_WR_DEPENDENCE,mark[EDGE_WR_DEPENDENCE]);
+        }
+
+        for(int d=defs.nodeStart[nodeid];d<defs.nodeStart[nodeid + 1];d++){
+            int dno = defs.itemDno[defs.nodeItems[d]];
+
+            /* definitions reaching a write */
+            addReachingEdges(graph,nodeid,inDefs,&defs,dno,EDGE_WW_DEPENDENCE,mark[EDGE_WW_DEPENDENCE]);
+
+            /* uses reaching a write */
+            addReachingEdges(graph,nodeid,inUses,&uses,dno,EDGE_RW_DEPENDENCE,mark[EDGE_RW_DEPENDENCE]);
+        }
+    }
+
+    for(int kind=0;kind<NUM_EDGE_KINDS;kind++)
+        pfree(mark[kind]);
+    pfree(inDefs);
+    pfree(inUses);
+}
@@ -3,7 +3,6 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <igraph/igraph.h>
 #include "pl_graphs.h"
 
 
@@ -29,6 +28,74 @@ void connectNodeToParents(int nodeid, List* parents){
 
 
 
+/* names of the edge kinds, indexed by GraphEdgeKind */
+static const char* edgeKindNames[NUM_EDGE_KINDS] = {
+    "FLOW",
+    "RW-DEPENDENCE",
+    "WR-DEPENDENCE",
+    "WW-DEPENDENCE"
+};
+
+
+/**
+ * returns the name of an edge kind
+ */
+const char* edgeKindName(GraphEdgeKind kind){
+    return edgeKindNames[kind];
+}
+
+
+/**
+ * returns the name of a statement kind (cmd_type), as plpgsql names the
+ * statements in its error context
+ */
+const char* stmtKindName(int kind){
+    switch(kind){
+        case PLPGSQL_STMT_BLOCK:        return "statement block";
+        case PLPGSQL_STMT_ASSIGN:       return "assignment";
+        case PLPGSQL_STMT_IF:           return "IF";
+        case PLPGSQL_STMT_CASE:         return "CASE";
+        case PLPGSQL_STMT_LOOP:         return "LOOP";
+        case PLPGSQL_STMT_WHILE:        return "WHILE";
+        case PLPGSQL_STMT_FORI:         return "FOR with integer loop variable";
+        case PLPGSQL_STMT_FORS:         return "FOR over SELECT rows";
+        case PLPGSQL_STMT_FORC:         return "FOR over cursor";
+        case PLPGSQL_STMT_FOREACH_A:    return "FOREACH over array";
+        case PLPGSQL_STMT_EXIT:         return "EXIT";
+        case PLPGSQL_STMT_RETURN:       return "RETURN";
+        case PLPGSQL_STMT_RETURN_NEXT:  return "RETURN NEXT";
+        case PLPGSQL_STMT_RETURN_QUERY: return "RETURN QUERY";
+        case PLPGSQL_STMT_RAISE:        return "RAISE";
+        case PLPGSQL_STMT_ASSERT:       return "ASSERT";
+        case PLPGSQL_STMT_EXECSQL:      return "SQL statement";
+        case PLPGSQL_STMT_DYNEXECUTE:   return "EXECUTE";
+        case PLPGSQL_STMT_DYNFORS:      return "FOR over EXECUTE statement";
+        case PLPGSQL_STMT_GETDIAG:      return "GET DIAGNOSTICS";
+        case PLPGSQL_STMT_OPEN:         return "OPEN";
+        case PLPGSQL_STMT_FETCH:        return "FETCH";
+        case PLPGSQL_STMT_CLOSE:        return "CLOSE";
+        case PLPGSQL_STMT_PERFORM:      return "PERFORM";
+    }
+    return "unknown";
+}
+
+
+/**
+ * returns the edge kind with the given name or -1 if there is none
+ */
+int edgeKindFromName(const char* name){
+    if(name == NULL)
+        return -1;
+
+    for(int kind=0;kind<NUM_EDGE_KINDS;kind++){
+        if(strcmp(edgeKindNames[kind],name) == 0)
+            return kind;
+    }
+    return -1;
+}
+
+
+
 /**
  * get the node of the given list with a specific id
  */
@@ -66,3 +133,304 @@ struct edge* getNthEdgeFromNode(List* nodes, long int nodeid, int n){
     }
 }
 
+
+
+
+/**
+ * creates a graph with the given number of nodes and no edges
+ */
+PLGraph* initGraph(int nnodes,
+                   PLpgSQL_datum**         datums,
+                   int                     ndatums,
+                   PLpgSQL_function*       function,
+                   PLpgSQL_execstate*      estate){
+
+    PLGraph* graph = palloc0(sizeof(PLGraph));
+
+    graph->nnodes = nnodes;
+    graph->stmts = palloc0(nnodes * sizeof(PLpgSQL_stmt*));
+    graph->labels = palloc0(nnodes * sizeof(char*));
+    graph->reads = palloc0(nnodes * sizeof(Bitmapset*));
+    graph->writes = palloc0(nnodes * sizeof(Bitmapset*));
+    graph->stmtHashes = palloc0(nnodes * sizeof(uint64));
+
+    /* a flow graph has about one edge per node, dependences come on top */
+    graph->maxedges = Max(2 * nnodes, 16);
+    graph->edgeFrom = palloc(graph->maxedges * sizeof(int));
+    graph->edgeTo = palloc(graph->maxedges * sizeof(int));
+    graph->edgeKind = palloc(graph->maxedges * sizeof(uint8));
+    graph->edgeLabels = palloc(graph->maxedges * sizeof(char*));
+
+    graph->outStart = palloc0((nnodes + 1) * sizeof(int));
+    graph->outEdges = NULL;
+
+    graph->function = function;
+    graph->estate = estate;
+    graph->datums = datums;
+    graph->ndatums = ndatums;
+
+    return graph;
+}
+
+
+/**
+ * adds an edge of the given kind and returns its id. The adjacency
+ * covers the new edge only after the next buildGraphAdjacency.
+ */
+int addGraphEdge(PLGraph* graph, int from, int to, GraphEdgeKind kind){
+
+    /* grow the edge arrays */
+    if(graph->nedges >= graph->maxedges){
+        graph->maxedges *= 2;
+        graph->edgeFrom = repalloc(graph->edgeFrom, graph->maxedges * sizeof(int));
+        graph->edgeTo = repalloc(graph->edgeTo, graph->maxedges * sizeof(int));
+        graph->edgeKind = repalloc(graph->edgeKind, graph->maxedges * sizeof(uint8));
+        graph->edgeLabels = repalloc(graph->edgeLabels, graph->maxedges * sizeof(char*));
+    }
+
+    graph->edgeFrom[graph->nedges] = from;
+    graph->edgeTo[graph->nedges] = to;
+    graph->edgeKind[graph->nedges] = kind;
+    graph->edgeLabels[graph->nedges] = "";
+
+    return graph->nedges++;
+}
+
+
+/**
+ * (re)builds the CSR adjacency of the outgoing edges. The out edges
+ * of every node keep the order in which they were added.
+ */
+void buildGraphAdjacency(PLGraph* graph){
+
+    int* next;
+
+    if(graph->outEdges != NULL)
+        pfree(graph->outEdges);
+    graph->outEdges = palloc(Max(graph->nedges,1) * sizeof(int));
+
+    /* count the out edges per node */
+    memset(graph->outStart, 0, (graph->nnodes + 1) * sizeof(int));
+    for(int eid=0;eid<graph->nedges;eid++){
+        graph->outStart[graph->edgeFrom[eid] + 1]++;
+    }
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
+        graph->outStart[nodeid + 1] += graph->outStart[nodeid];
+    }
+
+    /* place the edges */
+    next = palloc(Max(graph->nnodes,1) * sizeof(int));
+    memcpy(next, graph->outStart, graph->nnodes * sizeof(int));
+    for(int eid=0;eid<graph->nedges;eid++){
+        graph->outEdges[next[graph->edgeFrom[eid]]++] = eid;
+    }
+    pfree(next);
+
+    graph->nadjacent = graph->nedges;
+}
+
+
+/**
+ * builds the per datum lists of reading and writing nodes from the read
+ * and write sets of the nodes
+ */
+static void buildAccessList(PLGraph* graph, Bitmapset** sets, int** start, int** nodes){
+    int* next;
+
+    *start = palloc0((graph->ndatums + 1) * sizeof(int));
+
+    /* count the nodes per datum */
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
+        int dno = -1;
+        while((dno = bms_next_member(sets[nodeid], dno)) >= 0)
+            (*start)[dno + 1]++;
+    }
+    for(int dno=0;dno<graph->ndatums;dno++){
+        (*start)[dno + 1] += (*start)[dno];
+    }
+
+    /* nodes are visited in order, so the lists are sorted */
+    *nodes = palloc(Max((*start)[graph->ndatums],1) * sizeof(int));
+    next = palloc(Max(graph->ndatums,1) * sizeof(int));
+    memcpy(next, *start, graph->ndatums * sizeof(int));
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
+        int dno = -1;
+        while((dno = bms_next_member(sets[nodeid], dno)) >= 0)
+            (*nodes)[next[dno]++] = nodeid;
+    }
+    pfree(next);
+}
+
+
+/**
+ * builds the variable index of the graph, the lists of nodes reading
+ * and writing each datum. Needs the reads and writes of the nodes.
+ */
+void buildVariableIndex(PLGraph* graph){
+    buildAccessList(graph,graph->reads,&graph->readerStart,&graph->readers);
+    buildAccessList(graph,graph->writes,&graph->writerStart,&graph->writers);
+}
+
+
+/**
+ * mixes the bits of a pointer or node pair, the murmur3 finalizer
+ */
+static inline uint64 hashBits(uint64 h){
+    h ^= h >> 33;
+    h *= UINT64CONST(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64CONST(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+/* # of slots of an open addressing table holding n keys at most half full */
+static int tableSize(int n){
+    int size = 16;
+    while(size < 2 * n)
+        size <<= 1;
+    return size;
+}
+
+/* key of the node pair, never 0 as node ids are not negative */
+#define DependenceKey(from,to) ((((uint64) (from)) << 32 | (uint32) (to)) + 1)
+
+
+/**
+ * builds the hash of statements to their node ids, so a statement is
+ * found without scanning the nodes. Needs the statements of the nodes.
+ */
+void buildStmtIndex(PLGraph* graph){
+    int size = tableSize(graph->nnodes);
+
+    if(graph->stmtSlots != NULL)
+        pfree(graph->stmtSlots);
+    graph->stmtSlots = palloc(size * sizeof(int));
+    memset(graph->stmtSlots, -1, size * sizeof(int));
+    graph->stmtMask = size - 1;
+
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
+        PLpgSQL_stmt* stmt = graph->stmts[nodeid];
+        uint64 slot;
+
+        if(stmt == NULL)
+            continue;
+
+        slot = hashBits((uint64) (uintptr_t) stmt) & graph->stmtMask;
+        while(graph->stmtSlots[slot] != -1){
+            /* a statement keeps its first node */
+            if(graph->stmts[graph->stmtSlots[slot]] == stmt)
+                break;
+            slot = (slot + 1) & graph->stmtMask;
+        }
+        if(graph->stmtSlots[slot] == -1)
+            graph->stmtSlots[slot] = nodeid;
+    }
+}
+
+
+/**
+ * returns the node of the statement or -1 if it has none
+ */
+int lookupStmtNode(PLGraph* graph, PLpgSQL_stmt* stmt){
+    uint64 slot;
+
+    if(stmt == NULL || graph->stmtSlots == NULL)
+        return -1;
+
+    slot = hashBits((uint64) (uintptr_t) stmt) & graph->stmtMask;
+    while(graph->stmtSlots[slot] != -1){
+        if(graph->stmts[graph->stmtSlots[slot]] == stmt)
+            return graph->stmtSlots[slot];
+        slot = (slot + 1) & graph->stmtMask;
+    }
+    return -1;
+}
+
+
+/**
+ * builds the set of node pairs joined by a dependence edge of any kind.
+ * Must be rebuilt when dependence edges are added.
+ */
+void buildDependenceIndex(PLGraph* graph){
+    int ndependences = 0;
+    int size;
+
+    for(int eid=0;eid<graph->nedges;eid++){
+        if(graph->edgeKind[eid] != EDGE_FLOW)
+            ndependences++;
+    }
+
+    size = tableSize(ndependences);
+    if(graph->depSlots != NULL)
+        pfree(graph->depSlots);
+    graph->depSlots = palloc0(size * sizeof(uint64));
+    graph->depMask = size - 1;
+
+    for(int eid=0;eid<graph->nedges;eid++){
+        uint64 key;
+        uint64 slot;
+
+        if(graph->edgeKind[eid] == EDGE_FLOW)
+            continue;
+
+        key = DependenceKey(graph->edgeFrom[eid],graph->edgeTo[eid]);
+        slot = hashBits(key) & graph->depMask;
+        while(graph->depSlots[slot] != 0 && graph->depSlots[slot] != key)
+            slot = (slot + 1) & graph->depMask;
+        graph->depSlots[slot] = key;
+    }
+}
+
+
+/**
+ * is there a dependence edge from one node to the other, valid after
+ * buildDependenceIndex
+ */
+bool hasDependenceEdge(PLGraph* graph, int from, int to){
+    uint64 key = DependenceKey(from,to);
+    uint64 slot;
+
+    if(graph->depSlots == NULL)
+        return false;
+
+    slot = hashBits(key) & graph->depMask;
+    while(graph->depSlots[slot] != 0){
+        if(graph->depSlots[slot] == key)
+            return true;
+        slot = (slot + 1) & graph->depMask;
+    }
+    return false;
+}
+
+
+/**
+ * frees the arrays of a graph. Labels and read/write sets are not
+ * owned by the graph.
+ */
+void destroyGraph(PLGraph* graph){
+    pfree(graph->stmts);
+    pfree(graph->labels);
+    pfree(graph->reads);
+    pfree(graph->writes);
+    pfree(graph->edgeFrom);
+    pfree(graph->edgeTo);
+    pfree(graph->edgeKind);
+    pfree(graph->edgeLabels);
+    pfree(graph->outStart);
+    if(graph->outEdges != NULL)
+        pfree(graph->outEdges);
+    if(graph->reach != NULL)
+        destroyReachability(graph->reach);
+    if(graph->readerStart != NULL){
+        pfree(graph->readerStart);
+        pfree(graph->readers);
+        pfree(graph->writerStart);
+        pfree(graph->writers);
+    }
+    if(graph->stmtSlots != NULL)
+        pfree(graph->stmtSlots);
+    if(graph->depSlots != NULL)
+        pfree(graph->depSlots);
+    pfree(graph);
+}
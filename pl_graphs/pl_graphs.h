@@ -1,9 +1,19 @@
 #include "plpgsql.h"
 #include "nodes/pg_list.h"
+#include "lib/stringinfo.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef USE_IGRAPH
 #include <igraph/igraph.h>
+#endif
+
+/* max size of a reachability matrix, larger graphs are searched instead */
+#define MAXREACHABILITYSIZE (16 * 1024 * 1024)
+
+/* max # of statements whose read and write sets are remembered per process */
+#define STMT_MEMO_SIZE 16384
+
 #define eos(s) ((s)+strlen(s))
 
 
@@ -27,13 +37,153 @@ struct node{
 struct graph_status{
     List* parents;
     List* nodes;
+    int   unsupported;  /* # of statements left out of the graph */
 };
 
+#ifdef USE_IGRAPH
 union dblPointer{
     double doublevalue;
     long int longvalue;
     void* pointer;
 };
+#endif
+
+
+/**
+ * Kinds of graph edges
+ */
+typedef enum GraphEdgeKind{
+    EDGE_FLOW = 0,          /* control flow */
+    EDGE_RW_DEPENDENCE,     /* read -> write (anti) dependence */
+    EDGE_WR_DEPENDENCE,     /* write -> read (flow) dependence */
+    EDGE_WW_DEPENDENCE,     /* write -> write (output) dependence */
+    NUM_EDGE_KINDS
+} GraphEdgeKind;
+
+
+/**
+ * Reachability relation of a graph. The nodes are condensed to their
+ * strongly connected components, which are numbered in reverse
+ * topological order. rows holds per component the bit vector of the
+ * nodes it reaches, or is NULL if it was not asked for or would be too
+ * large.
+ */
+typedef struct GraphReachability{
+    int                 nnodes;         /* # of nodes */
+    int                 ncomponents;    /* # of strongly connected components */
+    int*                component;      /* component per node */
+    bool*               cyclic;         /* per component, true if it contains a cycle */
+    int*                memberStart;    /* nodes of component c are members[memberStart[c]..memberStart[c+1]-1] */
+    int*                members;
+    int*                succStart;      /* successors of component c are succs[succStart[c]..succStart[c+1]-1] */
+    int*                succs;
+    int                 nwords;         /* words per row */
+    uint64*             rows;           /* reachable nodes per component */
+} GraphReachability;
+
+
+/**
+ * Flow and dependence graph of a plpgsql function. Node and edge
+ * properties are kept in dense arrays indexed by node and edge id,
+ * the outgoing edges of the nodes in a CSR adjacency.
+ */
+typedef struct PLGraph{
+    int                 nnodes;         /* # of nodes, node 0 is the entry */
+    PLpgSQL_stmt**      stmts;          /* statement per node, NULL for the entry */
+    char**              labels;         /* label per node */
+    Bitmapset**         reads;          /* datums read per node */
+    Bitmapset**         writes;         /* datums written per node */
+    uint64*             stmtHashes;     /* structural hash per node its reads and writes are memoized under, 0 if none */
+
+    int                 nedges;         /* # of edges */
+    int                 maxedges;       /* allocated size of the edge arrays */
+    int*                edgeFrom;       /* source node per edge */
+    int*                edgeTo;         /* target node per edge */
+    uint8*              edgeKind;       /* GraphEdgeKind per edge */
+    const char**        edgeLabels;     /* label per edge */
+
+    int*                outStart;       /* out edges of node n are outEdges[outStart[n]..outStart[n+1]-1] */
+    int*                outEdges;       /* edge ids grouped by source node */
+    int                 nadjacent;      /* # of edges covered by the adjacency */
+
+    GraphReachability*  reach;          /* components of the flow edges, built with the dependence edges, may be NULL */
+
+    int*                readerStart;    /* nodes reading datum d are readers[readerStart[d]..readerStart[d+1]-1] */
+    int*                readers;        /* sorted by node id */
+    int*                writerStart;    /* nodes writing datum d are writers[writerStart[d]..writerStart[d+1]-1] */
+    int*                writers;        /* sorted by node id */
+
+    int*                stmtSlots;      /* hash of statement to node id, -1 marks a free slot */
+    int                 stmtMask;       /* # of statement slots - 1 */
+    uint64*             depSlots;       /* hash set of node pairs joined by a dependence edge, 0 marks a free slot */
+    int                 depMask;        /* # of dependence slots - 1 */
+
+    int                 nunsupported;   /* # of statements left out as unsupported */
+
+    PLpgSQL_function*   function;       /* the function of the graph */
+    PLpgSQL_execstate*  estate;         /* its execution state, may be NULL */
+    PLpgSQL_datum**     datums;         /* its datums */
+    int                 ndatums;        /* # of datums */
+} PLGraph;
+
+/* out edges of a node, valid after buildGraphAdjacency */
+#define GraphOutEdges(graph,nodeid) \
+    (&(graph)->outEdges[(graph)->outStart[(nodeid)]])
+#define GraphOutDegree(graph,nodeid) \
+    ((graph)->outStart[(nodeid)+1] - (graph)->outStart[(nodeid)])
+
+
+/**
+ * Compact binary image of a graph. It is what is stored per function and
+ * is rendered to dot only when it is read. The header is followed by the
+ * node array, the edge array (grouped by kind), the variable array with
+ * the node ids of their readers and writers and the string pool.
+ */
+#define GRAPH_IMAGE_MAGIC 0x50474733    /* "PGG3" */
+
+typedef struct GraphImageNode{
+    uint64 stmtHash;        /* structural hash of the statement, 0 if none, see hashStmt */
+    int32  stmtKind;        /* cmd_type of the statement, 0 for the entry node */
+    int32  lineno;          /* line number of the statement */
+    uint32 label;           /* offset of the label in the string pool */
+} GraphImageNode;
+
+typedef struct GraphImageEdge{
+    int32  from;            /* source node */
+    int32  to;              /* target node */
+    uint32 label;           /* offset of the label in the string pool */
+} GraphImageEdge;
+
+typedef struct GraphImageVariable{
+    uint32 name;            /* offset of the name in the string pool */
+    int32  dno;             /* datum number */
+    int32  start;           /* readers are accesses[start..], the writers follow them */
+    int32  nreaders;        /* # of nodes reading the datum */
+    int32  nwriters;        /* # of nodes writing the datum */
+} GraphImageVariable;
+
+typedef struct GraphImage{
+    uint32 magic;           /* GRAPH_IMAGE_MAGIC */
+    int32  size;            /* total size of the image in bytes */
+    int32  nnodes;          /* # of nodes */
+    int32  nedges;          /* # of edges */
+    int32  nvariables;      /* # of datums read or written */
+    int32  naccesses;       /* # of reading and writing nodes of all datums */
+    int32  edgeStart[NUM_EDGE_KINDS+1]; /* edges of kind k are edgeStart[k]..edgeStart[k+1]-1 */
+} GraphImage;
+
+#define GraphImageNodes(image) \
+    ((GraphImageNode*) ((char*) (image) + MAXALIGN(sizeof(GraphImage))))
+#define GraphImageEdges(image) \
+    ((GraphImageEdge*) (GraphImageNodes(image) + (image)->nnodes))
+#define GraphImageVariables(image) \
+    ((GraphImageVariable*) (GraphImageEdges(image) + (image)->nedges))
+#define GraphImageAccesses(image) \
+    ((int32*) (GraphImageVariables(image) + (image)->nvariables))
+#define GraphImageStrings(image) \
+    ((char*) (GraphImageAccesses(image) + (image)->naccesses))
+#define GraphImageString(image,offset) \
+    (GraphImageStrings(image) + (offset))
 
 
 
@@ -61,11 +211,36 @@ Bitmapset* getParametersOfQueryExpr(PLpgSQL_expr*           expr,
                                     PLpgSQL_function*       surroundingFunction,
                                     PLpgSQL_execstate*      estate);
 
+/* ----------
+ * Functions in pl_stmt_memo.c
+ * ----------
+ */
+uint64 hashStmt(PLpgSQL_stmt* stmt, PLpgSQL_function* function);
+bool lookupStmtMemo(uint64 hash, Bitmapset** reads, Bitmapset** writes);
+void storeStmtMemo(uint64 hash, Bitmapset* reads, Bitmapset* writes);
+void seedStmtMemo(GraphImage* image);
+
 /* ----------
  * Functions in pl_graph_ops.c
  * ----------
  */
 void connectNodeToParents(int nodeid, List* parents);
+const char* edgeKindName(GraphEdgeKind kind);
+int edgeKindFromName(const char* name);
+const char* stmtKindName(int kind);
+PLGraph* initGraph(int nnodes,
+                   PLpgSQL_datum**         datums,
+                   int                     ndatums,
+                   PLpgSQL_function*       function,
+                   PLpgSQL_execstate*      estate);
+int addGraphEdge(PLGraph* graph, int from, int to, GraphEdgeKind kind);
+void buildGraphAdjacency(PLGraph* graph);
+void buildVariableIndex(PLGraph* graph);
+void buildStmtIndex(PLGraph* graph);
+void buildDependenceIndex(PLGraph* graph);
+int lookupStmtNode(PLGraph* graph, PLpgSQL_stmt* stmt);
+bool hasDependenceEdge(PLGraph* graph, int from, int to);
+void destroyGraph(PLGraph* graph);
 struct node* getNodeById(List* nodes,long int currentId);
 struct edge* getNthEdgeFromNode(List* nodes, long int nodeid, int n);
 
@@ -74,7 +249,7 @@ struct edge* getNthEdgeFromNode(List* nodes, long int nodeid, int n);
  * Functions in pl_plstmts2igraph.c
  * ----------
  */
-igraph_t* createFlowGraph(
+PLGraph* createFlowGraph(
                             PLpgSQL_datum**         datums,
                             int                     ndatums,
                             PLpgSQL_function* function,
@@ -87,64 +262,75 @@ void createProgramGraph(int* newnodeid,
                     struct graph_status* status,
                     List* statements,
                     PLpgSQL_function* function);
-igraph_t* buildIGraph(List* nodes,
-                      PLpgSQL_datum**         datums,
-                      int                     ndatums,
-                      PLpgSQL_function* function,
-                      PLpgSQL_execstate * estate);
+PLGraph* buildGraph(List* nodes,
+                    PLpgSQL_datum**         datums,
+                    int                     ndatums,
+                    PLpgSQL_function* function,
+                    PLpgSQL_execstate * estate);
 
 /* ----------
  * Functions in pl_igraph_export.c
  * ----------
  */
-void printReadsAndWrites(igraph_t* graph, long nodeid, Datum* arguments, Datum* result, bool breakIfFound);
-char* convertGraphToDotFormat(  igraph_t* graph,
+void printReadsAndWrites(PLGraph* graph, long nodeid);
+GraphImage* convertGraphToImage(PLGraph* graph);
+char* convertGraphToDotFormat(  GraphImage* image,
                                 List* edgeTypes,
                                 bool edgeLabels,
                                 bool sameLevel,
                                 char* additionalGeneralConfiguration,
                                 char* additionalNodeConfiguration,
-                                int maxDotFileSize);
-void appendNodeToDot(igraph_t* graph, long nodeid, Datum* arguments, Datum* result, bool breakIfFound);
-void appendEdgeToDot(igraph_t* graph, long eid, long from, long to, Datum* arguments, Datum* result, bool breakIfFound);
-void buildRank(igraph_t* graph, long nodeid, Datum* arguments, Datum* result, bool lastElement);
-void iterateEdgesBridge(igraph_t* igraph, long nodeid, Datum* arguments, Datum* results, bool breakIfFound);
+                                bool compact);
+char* convertGraphToFlowGraphDot(GraphImage* image, bool compact);
+char* convertGraphToProgramDependenceGraphDot(GraphImage* image, bool compact);
+char* convertGraphToCustomDot(GraphImage* image, int edgeKinds, bool edgeLabels, bool sameRank, bool compact);
+void appendDotEscaped(StringInfo buf, const char* string);
+void appendDotLineEnd(StringInfo buf, bool compact);
+void appendNodeToDot(StringInfo buf, GraphImage* image, long nodeid, char* additionalAttributes, bool compact);
+void appendEdgeToDot(StringInfo buf, GraphImage* image, GraphImageEdge* edge, bool showLabels, List* edgeData, bool compact);
+void buildRank(StringInfo buf, long nodeid, bool lastElement);
 
 
 /* ----------
- * Functions in pl_igraph_ops.c
+ * Functions in pl_igraph_ops.c, only with igraph support
  * ----------
  */
+#ifdef USE_IGRAPH
 void setIGraphGlobalAttrP(igraph_t* igraph, const char* name, void* pointer);
-void* getIGraphGlobalAttrP(igraph_t* igraph, const char* name);
 void setIGraphGlobalAttrL(igraph_t* igraph, const char* name, long value);
-long getIGraphGlobalAttrL(igraph_t* igraph, const char* name);
-void setIGraphGlobalAttrS(igraph_t* igraph, const char* name, char* value);
-const char* getIGraphGlobalAttrS(igraph_t* igraph, const char* name);
 void setIGraphNodeAttrP(igraph_t* igraph, const char* name, long nodeid, void* pointer);
-void* getIGraphNodeAttrP(igraph_t* igraph, const char* name, long nodeid);
 void setIGraphNodeAttrL(igraph_t* igraph, const char* name, long nodeid, long value);
-long getIGraphNodeAttrL(igraph_t* igraph, const char* name, long nodeid);
 void setIGraphNodeAttrS(igraph_t* igraph, const char* name, long nodeid, char* string);
-const char* getIGraphNodeAttrS(igraph_t* igraph, const char* name, long nodeid);
 void setIGraphEdgeAttrS(igraph_t* igraph, const char* name, long edgeid, char* string);
-const char* getIGraphEdgeAttrS(igraph_t* igraph, const char* name, long edgeid);
-void addEdgeWithAttr(igraph_t* igraph, long sourceNodeId, long targetNodeId, char* attr, char* value);
-void iterateIGraphNodes(igraph_t* igraph, void (*callback)(igraph_t*, long, Datum*, Datum*, bool),Datum* arguments, Datum* results, bool breakIfFound);
-void iterateIGraphOutEdges(igraph_t* igraph, long nodeid, void (*callback)(igraph_t*, long, long, long, Datum*, Datum*, bool),Datum* arguments, Datum* results, bool breakIfFound);
-void iterateReachableEdges(igraph_t* graph, void (*callback)(igraph_t*, long, long, long, Datum*, Datum*, bool),Datum* arguments, Datum* results, bool breakIfFound);
+igraph_t* convertGraphToIGraph(PLGraph* graph);
+#endif
+
 /* ----------
  * Functions in pl_igraphanalysis.c
  * ----------
  */
-void addLabels(int nodeid, igraph_t* igraph);
-void setReadsAndWrites(int nodeid, igraph_t* igraph);
-void addDependenceEges(igraph_t* igraph, long nodeid, Datum* argument, Datum* result, bool lastElem);
-void retrieveNodeNumber(igraph_t* igraph, long nodeId, Datum* argument, Datum* result, bool lastElem);
-long getNodeNumberToStmt(PLpgSQL_stmt* stmt1, igraph_t* graph);
-int dependenceConflict(int node1, int node2, igraph_t* igraph);
-int conflict(PLpgSQL_stmt* stmt1, PLpgSQL_stmt* stmt2, igraph_t* igraph);
-void addProgramDependenceEdges(igraph_t* igraph);
+void addLabels(int nodeid, PLGraph* graph);
+void setReadsAndWrites(int nodeid, PLGraph* graph);
+long getNodeNumberToStmt(PLpgSQL_stmt* stmt1, PLGraph* graph);
+int dependenceConflict(int node1, int node2, PLGraph* graph);
+int conflict(PLpgSQL_stmt* stmt1, PLpgSQL_stmt* stmt2, PLGraph* graph);
+bool* conflictMatrix(PLpgSQL_stmt** stmts, int nstmts, PLGraph* graph);
+void addProgramDependenceEdges(PLGraph* graph);
+
+/* ----------
+ * Functions in pl_dataflow.c
+ * ----------
+ */
+void addDataflowDependenceEdges(PLGraph* graph);
+
+/* ----------
+ * Functions in pl_reachability.c
+ * ----------
+ */
+GraphReachability* computeReachability(int nnodes, int nedges, const int* edgeFrom, const int* edgeTo, bool closure);
+GraphReachability* computeFlowReachability(PLGraph* graph, bool closure);
+bool isReachable(GraphReachability* reach, int from, int to);
+void destroyReachability(GraphReachability* reach);
 
 /* ----------
  * Functions in pl_list_ops.c
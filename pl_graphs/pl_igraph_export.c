@@ -3,104 +3,287 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <igraph/igraph.h>
 #include "pl_graphs.h"
+#include "lib/stringinfo.h"
 #include "storage/fd.h"
 /**
- * Prints out the variables that staments read and write to
+ * Logs the variables that staments read and write to at DEBUG1
  */
-void printReadsAndWrites(igraph_t* graph, long nodeid, Datum* arguments, Datum* result, bool breakIfFound){
+void printReadsAndWrites(PLGraph* graph, long nodeid){
 
 
-    PLpgSQL_function* function = getIGraphGlobalAttrP(graph,"function");
+    PLpgSQL_function* function = graph->function;
 
-    printf("\n\nOn: %s\n",VAS(graph,"label",nodeid));
+    elog(DEBUG1,"On: %s",graph->labels[nodeid]);
 
-    Bitmapset* bmsRead = bms_copy(getIGraphNodeAttrP(graph,"read",nodeid));
-    int dno;
-    while (!bms_is_empty(bmsRead) && (dno = bms_first_member(bmsRead)) >= 0){
+    int dno = -1;
+    while ((dno = bms_next_member(graph->reads[nodeid], dno)) >= 0){
         PLpgSQL_datum *datum = function->datums[dno];
 
         if (datum->dtype == PLPGSQL_DTYPE_VAR)
         {
             PLpgSQL_var *var = (PLpgSQL_var *) datum;
-            printf("Reading: %s\n",var->refname);
+            elog(DEBUG1,"Reading: %s",var->refname);
         }
     }
 
 
 
-    Bitmapset* bmsWrite = bms_copy(getIGraphNodeAttrP(graph,"write",nodeid));
-    while (!bms_is_empty(bmsWrite) && (dno = bms_first_member(bmsWrite)) >= 0){
+    dno = -1;
+    while ((dno = bms_next_member(graph->writes[nodeid], dno)) >= 0){
         PLpgSQL_datum *datum = function->datums[dno];
 
         if (datum->dtype == PLPGSQL_DTYPE_VAR)
         {
             PLpgSQL_var *var = (PLpgSQL_var *) datum;
-            printf("Writing: %s\n",var->refname);
+            elog(DEBUG1,"Writing: %s",var->refname);
         }
     }
 
 }
 
 
+/**
+ * Adds a string to the string pool of an image and returns its offset
+ */
+static uint32 appendImageString(StringInfo strings, const char* string){
+    uint32 offset = strings->len;
+
+    if(string == NULL)
+        string = "";
+    appendBinaryStringInfo(strings, string, strlen(string) + 1);
+    return offset;
+}
+
+
+/**
+ * Returns the name of a datum, the datum number for those without one
+ */
+static char* datumName(PLpgSQL_datum** datums, int dno){
+    switch(datums[dno]->dtype){
+        case PLPGSQL_DTYPE_VAR:
+        case PLPGSQL_DTYPE_ROW:
+        case PLPGSQL_DTYPE_REC:
+            return varnumberToVarname(dno,datums);
+        default:{
+            char* name = palloc(16);
+            snprintf(name,16,"$%d",dno);
+            return name;
+        }
+    }
+}
+
+
+/**
+ * Converts the given graph to a compact graph image
+ */
+GraphImage* convertGraphToImage(PLGraph* graph){
+
+    long            nnodes = graph->nnodes;
+    long            nedges = graph->nedges;
+    StringInfoData  strings;
+    GraphImageNode* nodes;
+    GraphImageEdge* edges;
+    GraphImageVariable* variables;
+    int32*          accesses;
+    int             nvariables = 0;
+    int             naccesses = 0;
+    GraphImage*     image;
+    int             kindCount[NUM_EDGE_KINDS];
+    int             kindNext[NUM_EDGE_KINDS];
+    long            nstored = 0;
+    Size            size;
+
+    /* edge labels are only "", "0" and "1", they share one string each */
+    uint32          emptyLabel;
+    uint32          trueLabel;
+    uint32          falseLabel;
+
+    initStringInfo(&strings);
+    emptyLabel = appendImageString(&strings,"");
+    trueLabel = appendImageString(&strings,"1");
+    falseLabel = appendImageString(&strings,"0");
+
+    nodes = palloc0(Max(nnodes,1) * sizeof(GraphImageNode));
+    edges = palloc0(Max(nedges,1) * sizeof(GraphImageEdge));
+    memset(kindCount, 0, sizeof(kindCount));
+
+    /* nodes with their statement kind, line and label */
+    for(long nodeid=0;nodeid<nnodes;nodeid++){
+        PLpgSQL_stmt* stmt = graph->stmts[nodeid];
+
+        nodes[nodeid].stmtHash = graph->stmtHashes ? graph->stmtHashes[nodeid] : 0;
+        nodes[nodeid].stmtKind = (nodeid != 0 && stmt) ? stmt->cmd_type : 0;
+        nodes[nodeid].lineno = (nodeid != 0 && stmt) ? stmt->lineno : 0;
+        nodes[nodeid].label = appendImageString(&strings,graph->labels[nodeid]);
+    }
+
+    /* count the edges per kind */
+    for(long eid=0;eid<nedges;eid++){
+        kindCount[graph->edgeKind[eid]]++;
+    }
+
+    /* edges grouped by kind */
+    for(int kind=0, start=0;kind<NUM_EDGE_KINDS;kind++){
+        kindNext[kind] = start;
+        start += kindCount[kind];
+    }
+    for(long eid=0;eid<nedges;eid++){
+        const char*      label;
+        GraphImageEdge*  edge;
+
+        edge = &edges[kindNext[graph->edgeKind[eid]]++];
+        edge->from = graph->edgeFrom[eid];
+        edge->to = graph->edgeTo[eid];
+
+        label = graph->edgeLabels[eid];
+        if(label == NULL || label[0] == '\0')
+            edge->label = emptyLabel;
+        else if(strcmp(label,"1") == 0)
+            edge->label = trueLabel;
+        else if(strcmp(label,"0") == 0)
+            edge->label = falseLabel;
+        else
+            edge->label = appendImageString(&strings,label);
+        nstored++;
+    }
+
+    /* readers and writers of the datums that are accessed at all */
+    if(graph->readerStart == NULL)
+        buildVariableIndex(graph);
+    variables = palloc(Max(graph->ndatums,1) * sizeof(GraphImageVariable));
+    accesses = palloc(Max(graph->readerStart[graph->ndatums] + graph->writerStart[graph->ndatums],1) * sizeof(int32));
+    for(int dno=0;dno<graph->ndatums;dno++){
+        GraphImageVariable* variable = &variables[nvariables];
+
+        variable->nreaders = graph->readerStart[dno + 1] - graph->readerStart[dno];
+        variable->nwriters = graph->writerStart[dno + 1] - graph->writerStart[dno];
+        if(variable->nreaders == 0 && variable->nwriters == 0)
+            continue;
+
+        variable->dno = dno;
+        variable->name = appendImageString(&strings,datumName(graph->datums,dno));
+        variable->start = naccesses;
+        for(int i=graph->readerStart[dno];i<graph->readerStart[dno + 1];i++)
+            accesses[naccesses++] = graph->readers[i];
+        for(int i=graph->writerStart[dno];i<graph->writerStart[dno + 1];i++)
+            accesses[naccesses++] = graph->writers[i];
+        nvariables++;
+    }
+
+    /* put everything into one chunk */
+    size = MAXALIGN(sizeof(GraphImage)) +
+           nnodes * sizeof(GraphImageNode) +
+           nstored * sizeof(GraphImageEdge) +
+           nvariables * sizeof(GraphImageVariable) +
+           naccesses * sizeof(int32) +
+           strings.len;
+    image = palloc0(size);
+    image->magic = GRAPH_IMAGE_MAGIC;
+    image->size = size;
+    image->nnodes = nnodes;
+    image->nedges = nstored;
+    image->nvariables = nvariables;
+    image->naccesses = naccesses;
+    image->edgeStart[0] = 0;
+    for(int kind=0;kind<NUM_EDGE_KINDS;kind++){
+        image->edgeStart[kind+1] = image->edgeStart[kind] + kindCount[kind];
+    }
+    memcpy(GraphImageNodes(image), nodes, nnodes * sizeof(GraphImageNode));
+    memcpy(GraphImageEdges(image), edges, nstored * sizeof(GraphImageEdge));
+    memcpy(GraphImageVariables(image), variables, nvariables * sizeof(GraphImageVariable));
+    memcpy(GraphImageAccesses(image), accesses, naccesses * sizeof(int32));
+    memcpy(GraphImageStrings(image), strings.data, strings.len);
+
+    pfree(nodes);
+    pfree(edges);
+    pfree(variables);
+    pfree(accesses);
+    pfree(strings.data);
+
+    return image;
+}
+
+
+/**
+ * Appends a string to a quoted dot string, escaping quotes, backslashes
+ * and line breaks
+ */
+void appendDotEscaped(StringInfo buf, const char* string){
+    const char* start = string;
+
+    for(const char* c = string;*c != '\0';c++){
+        const char* escaped;
+
+        switch(*c){
+            case '"':   escaped = "\\\""; break;
+            case '\\':  escaped = "\\\\"; break;
+            case '\n':  escaped = "\\n"; break;
+            case '\r':  escaped = ""; break;
+            default:    continue;
+        }
+
+        /* copy the plain characters in one go */
+        appendBinaryStringInfo(buf, start, c - start);
+        appendStringInfoString(buf, escaped);
+        start = c + 1;
+    }
+    appendStringInfoString(buf, start);
+}
+
+
+/**
+ * Ends a line of the dot string, compact dot is written in a single line
+ */
+void appendDotLineEnd(StringInfo buf, bool compact){
+    if(!compact)
+        appendStringInfoChar(buf,'\n');
+}
+
+
 /**
  * Append Node data to the dot string buffer
  */
-void appendNodeToDot(igraph_t* graph, long nodeid, Datum* arguments, Datum* result, bool breakIfFound){
-    char* buf = DatumGetPointer(arguments[0]);
-    char* additionalAttributes = DatumGetCString(arguments[1]);
+void appendNodeToDot(StringInfo buf, GraphImage* image, long nodeid, char* additionalAttributes, bool compact){
+    GraphImageNode* node = &GraphImageNodes(image)[nodeid];
 
-    /* if a label vertex attribute is given draw it to the current node */
-    sprintf(eos(buf),"%li[label=\"%s\"]", nodeid, VAS(graph,"label",nodeid));
+    /* draw the label to the current node */
+    appendStringInfo(buf,"%li[label=\"", nodeid);
+    appendDotEscaped(buf,GraphImageString(image,node->label));
+    appendStringInfoString(buf,"\"]");
     if(additionalAttributes != NULL)
-        sprintf(eos(buf),"%s",additionalAttributes);
-    sprintf(eos(buf),";\n");
+        appendStringInfoString(buf,additionalAttributes);
+    appendStringInfoChar(buf,';');
+    appendDotLineEnd(buf,compact);
 }
 
 
 /**
  * Append Edge to the dot string buffer
  */
-void appendEdgeToDot(igraph_t* graph, long eid, long from, long to, Datum* arguments, Datum* result, bool breakIfFound){
-    /* The buffer to append the dot data to */
-    char* buf = DatumGetPointer(arguments[0]);
-    /* show labels attribute */
-    bool showLabels = DatumGetBool(arguments[1]);
-    /* edge types */
-    List* edgeTypes = (List*)DatumGetPointer(arguments[2]);
+void appendEdgeToDot(StringInfo buf, GraphImage* image, GraphImageEdge* edge, bool showLabels, List* edgeData, bool compact){
 
+    /* add edge */
+    appendStringInfo(buf,compact ? "%i->%i" : "%i -> %i",edge->from,edge->to);
+    /* penwidth */
+    appendStringInfoString(buf,"[penwidth=0.4]");
+    /* if show labes attribute is set -> add them */
+    if(showLabels){
 
-    ListCell* cell;
-    /* iterate given edge types that need to be added to the dot */
-    foreach(cell, edgeTypes){
-        List* edgeData = lfirst(cell);
-
-        /* of the edge has the current edge type type append the dot data */
-        if(strcmp(getIGraphEdgeAttrS(graph,"type",eid),linitial(edgeData)) == 0){
-            /* add edge */
-            sprintf(eos(buf),"%li -> %li",from,to);
-            /* penwidth */
-            sprintf(eos(buf),"[penwidth=0.4]");
-            /* if show labes attribute is set -> add them */
-            if(showLabels){
-
-                const char* label = getIGraphEdgeAttrS(graph,"label",eid);
-
-                if(label != NULL){
-                    sprintf(eos(buf),"[label=\"\%s\"]",label);
-                }
-            }
-            /* add the color */
-            sprintf(eos(buf),"[color=%s]",lsecond(edgeData));
-
-            /* additional properties */
-            if(edgeData->length > 2){
-                sprintf(eos(buf),"%s",lthird(edgeData));
-            }
+        const char* label = GraphImageString(image,edge->label);
 
+        if(label[0] != '\0'){
+            appendStringInfoString(buf,"[label=\"");
+            appendDotEscaped(buf,label);
+            appendStringInfoString(buf,"\"]");
         }
+    }
+    /* add the color */
+    appendStringInfo(buf,"[color=%s]",(char*) lsecond(edgeData));
 
+    /* additional properties */
+    if(edgeData->length > 2){
+        appendStringInfoString(buf,(char*) lthird(edgeData));
     }
 }
 
@@ -109,80 +292,157 @@ void appendEdgeToDot(igraph_t* graph, long eid, long from, long to, Datum* argum
 /**
  *  create Rank
  */
-void buildRank(igraph_t* graph, long nodeid, Datum* arguments, Datum* result, bool lastElement){
-    char* buf = DatumGetPointer(*arguments);
+void buildRank(StringInfo buf, long nodeid, bool lastElement){
 
-    /* if a label vertex attribute is given draw it to the current node */
-    sprintf(eos(buf),"%li",nodeid);
+    appendStringInfo(buf,"%li",nodeid);
 
 
     if(lastElement)
-        sprintf(eos(buf),";");
+        appendStringInfoChar(buf,';');
     else
-        sprintf(eos(buf),",");
+        appendStringInfoChar(buf,',');
 }
 
 
 /**
- * Converts the given igraph to dot format
+ * Converts the given graph image to dot format. Compact dot is written in
+ * a single line with minimal whitespace, for exports and the trimmed views.
  */
-char* convertGraphToDotFormat(  igraph_t* graph,
+char* convertGraphToDotFormat(  GraphImage* image,
                                 List* edgeTypes,
                                 bool edgeLabels,
                                 bool sameLevel,
                                 char* additionalGeneralConfiguration,
                                 char* additionalNodeConfiguration,
-                                int maxDotFileSize){
-
-    /* allocate space for the dot string */
-    char* buf = palloc(maxDotFileSize);
-    /* datum for dot string */
-    Datum bufDatum = PointerGetDatum(buf);
+                                bool compact){
 
+    /* the dot string grows as needed */
+    StringInfoData buf;
 
-    strcpy(buf, "");
+    initStringInfo(&buf);
 
     /* start of digraph with a little configuration */
-    sprintf(buf,"digraph g {\n");
-    sprintf(eos(buf),"nodesep=0.3;\n");
-    sprintf(eos(buf),"graph[pad=\"0.20,0.20\"];\n");
-    sprintf(eos(buf),"edge[arrowsize=0.6,penwidth=0.6];\n");
-    sprintf(eos(buf),"node[fontsize=10];\n");
-    if(additionalGeneralConfiguration != NULL)
-        sprintf(eos(buf),"%s",additionalGeneralConfiguration);
+    appendStringInfoString(&buf,compact ? "digraph g{" : "digraph g {");
+    appendDotLineEnd(&buf,compact);
+    appendStringInfoString(&buf,"nodesep=0.3;");
+    appendDotLineEnd(&buf,compact);
+    appendStringInfoString(&buf,"graph[pad=\"0.20,0.20\"];");
+    appendDotLineEnd(&buf,compact);
+    appendStringInfoString(&buf,"edge[arrowsize=0.6,penwidth=0.6];");
+    appendDotLineEnd(&buf,compact);
+    appendStringInfoString(&buf,"node[fontsize=10];");
+    appendDotLineEnd(&buf,compact);
+    if(additionalGeneralConfiguration != NULL){
+        appendStringInfoString(&buf,additionalGeneralConfiguration);
+        appendDotLineEnd(&buf,compact);
+    }
 
-    /* arguments for nodes */
-    Datum datumsNodes[2];
-    datumsNodes[0] = bufDatum;                                      /* string buffer */
-    datumsNodes[1] = CStringGetDatum(additionalNodeConfiguration);  /* Additional node conf */
 
+    /* create labels for nodes */
+    for(long nodeid=0;nodeid<image->nnodes;nodeid++){
+        appendNodeToDot(&buf,image,nodeid,additionalNodeConfiguration,compact);
+    }
 
-    /* iterate over igraph nodes and execute covertNodeLabelToDot to create labels for nodes */
-    iterateIGraphNodes(graph,&appendNodeToDot,datumsNodes,NULL,0);
 
+    ListCell* cell;
+    /* iterate given edge types that need to be added to the dot */
+    foreach(cell, edgeTypes){
+        List* edgeData = lfirst(cell);
+        int   kind = edgeKindFromName(linitial(edgeData));
 
-    /* Arguments for edges */
-    Datum datumsEdges[3];
-    datumsEdges[0] = bufDatum;                      /* string buffer */
-    datumsEdges[1] = BoolGetDatum(edgeLabels);      /* edge labels */
-    datumsEdges[2]  = PointerGetDatum(edgeTypes);   /* visible edge types */
+        if(kind < 0)
+            continue;
 
-    /* iterate over edges and execute convertEdgeLabelToDot to create edges */
-    iterateReachableEdges(graph,&appendEdgeToDot,datumsEdges,NULL,0);
+        /* append the edges of the current type */
+        for(int e=image->edgeStart[kind];e<image->edgeStart[kind+1];e++){
+            appendEdgeToDot(&buf,image,&GraphImageEdges(image)[e],edgeLabels,edgeData,compact);
+        }
+    }
 
     /* put nodes on the same level */
     if(sameLevel){
-        sprintf(eos(buf),"\n{rank=same; ");
-        iterateIGraphNodes(graph,&buildRank,&bufDatum,NULL,0);
-        sprintf(eos(buf),"}\n");
+        appendDotLineEnd(&buf,compact);
+        appendStringInfoString(&buf,compact ? "{rank=same;" : "{rank=same; ");
+        for(long nodeid=0;nodeid<image->nnodes;nodeid++){
+            buildRank(&buf,nodeid,nodeid == image->nnodes-1);
+        }
+        appendStringInfoChar(&buf,'}');
+        appendDotLineEnd(&buf,compact);
     }
 
 
     /* finish the graph */
-    sprintf(eos(buf),"}");
+    appendStringInfoChar(&buf,'}');
 
-    return buf;
+    return buf.data;
 }
 
 
+/**
+ * Renders the flow graph of an image
+ */
+char* convertGraphToFlowGraphDot(GraphImage* image, bool compact){
+    return convertGraphToDotFormat(
+                image,
+                /* Flow graph has only the FLOW edges with the color black */
+                list_make1(
+                list_make2("FLOW", "black")),
+                1,/* edge labels */
+                0,/* not on same level */
+                NULL,/* no additional general atrribs */
+                "[shape=box]",/* box shape */
+                compact);
+}
+
 
+/**
+ * Renders the program dependence graph of an image
+ */
+char* convertGraphToProgramDependenceGraphDot(GraphImage* image, bool compact){
+    return convertGraphToDotFormat(
+                image,
+                /* Dependence Graph edges with colors, Flow edges are dashed */
+                list_make4(
+                        list_make3("FLOW",         "black", "[style=dashed]"),
+                        list_make2("RW-DEPENDENCE","blue"),
+                        list_make2("WR-DEPENDENCE","green"),
+                        list_make2("WW-DEPENDENCE","red")),
+                0,/* no edge labels */
+                1,/* on same level */
+                "splines=ortho;",/* ortho */
+                NULL,/* no additional node attribs */
+                compact);
+}
+
+
+/**
+ * Renders an image with the given edge kinds (a bitmask of 1 << GraphEdgeKind)
+ * in the style of the flow graph and the program dependence graph
+ */
+char* convertGraphToCustomDot(GraphImage* image, int edgeKinds, bool edgeLabels, bool sameRank, bool compact){
+    /* colors of the edge kinds, indexed by GraphEdgeKind */
+    static char* colors[NUM_EDGE_KINDS] = {"black", "blue", "green", "red"};
+
+    List* edgeTypes = NIL;
+    bool  dependences = (edgeKinds & ~(1 << EDGE_FLOW)) != 0;
+
+    for(int kind=0;kind<NUM_EDGE_KINDS;kind++){
+        if(!(edgeKinds & (1 << kind)))
+            continue;
+
+        /* flow edges are dashed if dependences are shown as well */
+        if(kind == EDGE_FLOW && dependences)
+            edgeTypes = lappend(edgeTypes, list_make3((char*) edgeKindName(kind), colors[kind], "[style=dashed]"));
+        else
+            edgeTypes = lappend(edgeTypes, list_make2((char*) edgeKindName(kind), colors[kind]));
+    }
+
+    return convertGraphToDotFormat(
+                image,
+                edgeTypes,
+                edgeLabels,
+                sameRank,
+                sameRank ? "splines=ortho;" : NULL,
+                dependences ? NULL : "[shape=box]",
+                compact);
+}
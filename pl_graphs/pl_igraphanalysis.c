@@ -1,9 +1,10 @@
 #include "plpgsql.h"
+#include "access/xact.h"
 #include "nodes/pg_list.h"
+#include "utils/resowner.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <igraph/igraph.h>
 #include "pl_graphs.h"
 
 
@@ -12,23 +13,22 @@
 /**
  * adds labels to the current node and outgoing edges
  */
-void addLabels(int nodeid, igraph_t* igraph){
+void addLabels(int nodeid, PLGraph* graph){
 
 
 
-    PLpgSQL_stmt* stmt = getIGraphNodeAttrP(igraph,"stmt",nodeid);
-    PLpgSQL_datum**         datums = getIGraphGlobalAttrP(igraph,"datums");
+    PLpgSQL_stmt* stmt = graph->stmts[nodeid];
+    PLpgSQL_datum**         datums = graph->datums;
 
-    igraph_vector_t eids;
-    igraph_vector_init(&eids, 0);
-    igraph_incident(igraph, &eids, nodeid, IGRAPH_OUT);
+    /* outgoing edges of the node, their labels are blank by default */
+    int* eids = GraphOutEdges(graph,nodeid);
+    int  neids = GraphOutDegree(graph,nodeid);
 
-    /* Init edges labels to blank */
-    for(int i=0;i<igraph_vector_size(&eids);i++){
-        setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[i],"");
-    }
+    /* the label text grows as needed, label points to the final string */
+    StringInfoData buf;
+    char* label = NULL;
 
-    char* label = palloc(1024*sizeof(char));
+    initStringInfo(&buf);
 
     if(nodeid == 0){
         label = "entry";
@@ -44,14 +44,14 @@ void addLabels(int nodeid, igraph_t* igraph){
 
 
 
-                sprintf(label,"%s := %s",
+                appendStringInfo(&buf,"%s := %s",
                         varnumberToVarname( assignment->varno,
                                             datums),
                         expr->query);
 
 
                 /* remove the SELECT */
-                label = removeFromString(label,"SELECT ");
+                label = removeFromString(buf.data,"SELECT ");
                 break;
             }
             case PLPGSQL_STMT_RAISE:{
@@ -68,12 +68,12 @@ void addLabels(int nodeid, igraph_t* igraph){
                 label = removeFromStringN(ifStmt->cond->query,"SELECT ");
 
                 /* label the first edge with 1 */
-                if(igraph_vector_size(&eids) > 0){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[0],"1");
+                if(neids > 0){
+                    graph->edgeLabels[eids[0]] = "1";
                 }
                 /* and the second with 0 */
-                if(igraph_vector_size(&eids)> 1){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[1],"0");
+                if(neids> 1){
+                    graph->edgeLabels[eids[1]] = "0";
                 }
                 break;
             }
@@ -83,37 +83,37 @@ void addLabels(int nodeid, igraph_t* igraph){
                 label = removeFromStringN(whileStmt->cond->query,"SELECT ");
 
                 /* label the first edge with 1 */
-                if(igraph_vector_size(&eids) > 0){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[0],"1");
+                if(neids > 0){
+                    graph->edgeLabels[eids[0]] = "1";
                 }
                 /* and the second with 0 */
-                if(igraph_vector_size(&eids)> 1){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[1],"0");
+                if(neids> 1){
+                    graph->edgeLabels[eids[1]] = "0";
                 }
                 break;
             }
             case PLPGSQL_STMT_FORI:{
                 PLpgSQL_stmt_fori* foriStmt  = ((PLpgSQL_stmt_fori*)stmt);
 
-                sprintf(label,"FOR %s in %s..%s",
+                appendStringInfo(&buf,"FOR %s in %s..%s",
                         foriStmt->var->refname,
                         foriStmt->lower->query,
                         foriStmt->upper->query);
 
                 if(foriStmt->step)
-                    sprintf(eos(label)," by %s",foriStmt->step->query);
+                    appendStringInfo(&buf," by %s",foriStmt->step->query);
 
-                label = removeFromString(label,"SELECT ");
+                label = removeFromString(buf.data,"SELECT ");
 
 
 
                 /* label the first edge with 1 */
-                if(igraph_vector_size(&eids) > 0){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[0],"1");
+                if(neids > 0){
+                    graph->edgeLabels[eids[0]] = "1";
                 }
                 /* and the second with 0 */
-                if(igraph_vector_size(&eids)> 1){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[1],"0");
+                if(neids> 1){
+                    graph->edgeLabels[eids[1]] = "0";
                 }
 
                 break;
@@ -122,38 +122,38 @@ void addLabels(int nodeid, igraph_t* igraph){
                 PLpgSQL_stmt_fors* forsStmt  = ((PLpgSQL_stmt_fors*)stmt);
 
 
-                sprintf(label,"FOR ");
+                appendStringInfo(&buf,"FOR ");
 
                 if(forsStmt->rec && forsStmt->rec->dno){
 
-                    sprintf(eos(label),"%s",varnumberToVarname( forsStmt->rec->dno,
+                    appendStringInfo(&buf,"%s",varnumberToVarname( forsStmt->rec->dno,
                                                                 datums    ));
                 }
                 else if(forsStmt->row){
                     for(int i=0; i<forsStmt->row->nfields;i++){
 
-                        sprintf(eos(label),"%s",varnumberToVarname( forsStmt->row->varnos[i],
+                        appendStringInfo(&buf,"%s",varnumberToVarname( forsStmt->row->varnos[i],
                                                                     datums  ));
 
                         if(i != forsStmt->row->nfields-1){
-                            sprintf(eos(label),",");
+                            appendStringInfo(&buf,",");
                         }
 
                     }
                 }
 
-                sprintf(eos(label)," IN %s",
+                appendStringInfo(&buf," IN %s",
                         forsStmt->query->query);
 
 
 
                 /* label the first edge with 1 */
-                if(igraph_vector_size(&eids) > 0){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[0],"1");
+                if(neids > 0){
+                    graph->edgeLabels[eids[0]] = "1";
                 }
                 /* and the second with 0 */
-                if(igraph_vector_size(&eids)> 1){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[1],"0");
+                if(neids> 1){
+                    graph->edgeLabels[eids[1]] = "0";
                 }
 
                 break;
@@ -161,20 +161,20 @@ void addLabels(int nodeid, igraph_t* igraph){
             case PLPGSQL_STMT_FOREACH_A:{
                 PLpgSQL_stmt_foreach_a* foreachStmt  = ((PLpgSQL_stmt_foreach_a*)stmt);
 
-                sprintf(label,"FOREACH %s IN %s",
+                appendStringInfo(&buf,"FOREACH %s IN %s",
                         varnumberToVarname(foreachStmt->varno,datums),
                         foreachStmt->expr->query);
 
-                label = removeFromString(label,"SELECT ");
+                label = removeFromString(buf.data,"SELECT ");
 
 
                 /* label the first edge with 1 */
-                if(igraph_vector_size(&eids) > 0){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[0],"1");
+                if(neids > 0){
+                    graph->edgeLabels[eids[0]] = "1";
                 }
                 /* and the second with 0 */
-                if(igraph_vector_size(&eids)> 1){
-                    setIGraphEdgeAttrS(igraph,"label",VECTOR(eids)[1],"0");
+                if(neids> 1){
+                    graph->edgeLabels[eids[1]] = "0";
                 }
 
                 break;
@@ -184,10 +184,10 @@ void addLabels(int nodeid, igraph_t* igraph){
                 PLpgSQL_stmt_return* returnStmt  = ((PLpgSQL_stmt_return*)stmt);
                 /* concatinate RETURN with the return query */
 
-                sprintf(label,"RETURN %s ",returnStmt->expr->query);
+                appendStringInfo(&buf,"RETURN %s ",returnStmt->expr->query);
 
                 /* remove the SELECT */
-                label = removeFromString(label,"SELECT ");
+                label = removeFromString(buf.data,"SELECT ");
                 break;
             }
             case PLPGSQL_STMT_EXECSQL:{
@@ -196,25 +196,25 @@ void addLabels(int nodeid, igraph_t* igraph){
 
 
 
-                sprintf(label,"%s",execSqlStmt->sqlstmt->query);
+                appendStringInfo(&buf,"%s",execSqlStmt->sqlstmt->query);
 
 
                 if(execSqlStmt->into){
 
-                    sprintf(eos(label)," INTO ");
+                    appendStringInfo(&buf," INTO ");
                     if(execSqlStmt->rec){
 
-                        sprintf(eos(label),"%s",varnumberToVarname( execSqlStmt->rec->dno,
+                        appendStringInfo(&buf,"%s",varnumberToVarname( execSqlStmt->rec->dno,
                                                                     datums)  );
                     }
                     else if(execSqlStmt->row){
                         for(int i=0; i<execSqlStmt->row->nfields;i++){
 
-                            sprintf(eos(label),"%s",varnumberToVarname( execSqlStmt->row->varnos[i],
+                            appendStringInfo(&buf,"%s",varnumberToVarname( execSqlStmt->row->varnos[i],
                                                                         datums)  );
 
                             if(i != execSqlStmt->row->nfields-1){
-                                sprintf(eos(label),",");
+                                appendStringInfo(&buf,",");
                             }
 
                         }
@@ -225,7 +225,7 @@ void addLabels(int nodeid, igraph_t* igraph){
             }
             case PLPGSQL_STMT_PERFORM:{
                 PLpgSQL_stmt_perform* performSqlStmt  = ((PLpgSQL_stmt_perform*)stmt);
-                sprintf(label,"%s",performSqlStmt->expr->query);
+                appendStringInfo(&buf,"%s",performSqlStmt->expr->query);
                 break;
             }
             default:{
@@ -236,10 +236,13 @@ void addLabels(int nodeid, igraph_t* igraph){
         }
     }
 
+    /* the statements without a special label use the built text */
+    if(label == NULL)
+        label = buf.data;
+
     if(label){
-        /* set the label of the current node as attribute  */
-        /* to the corresponding node of the igraph */
-        setIGraphNodeAttrS(igraph,"label",nodeid,label);
+        /* set the label of the current node */
+        graph->labels[nodeid] = label;
     }
 }
 
@@ -247,22 +250,15 @@ void addLabels(int nodeid, igraph_t* igraph){
 
 
 /**
- * sets the reads and writes of statements in the graph nodes
+ * collects the reads and writes of the statement of a node from its queries
  */
-void setReadsAndWrites(int nodeid, igraph_t* igraph){
-
-    if(nodeid == 0)
-        return;
-
-    PLpgSQL_function* function = getIGraphGlobalAttrP(igraph,"function");
-    PLpgSQL_execstate* estate = getIGraphGlobalAttrP(igraph,"estate");
-    PLpgSQL_stmt* stmt = getIGraphNodeAttrP(igraph,"stmt",nodeid);
-    PLpgSQL_datum**         datums = getIGraphGlobalAttrP(igraph,"datums");
-    int                     ndatums = getIGraphGlobalAttrL(igraph,"ndatums");
-
-    setIGraphNodeAttrP(igraph,"read",nodeid,NULL);
-    setIGraphNodeAttrP(igraph,"write",nodeid,NULL);
+static void collectReadsAndWrites(int nodeid, PLGraph* graph){
 
+    PLpgSQL_function* function = graph->function;
+    PLpgSQL_execstate* estate = graph->estate;
+    PLpgSQL_stmt* stmt = graph->stmts[nodeid];
+    PLpgSQL_datum**         datums = graph->datums;
+    int                     ndatums = graph->ndatums;
 
     /* switch statement type */
     if(stmt && stmt->cmd_type){
@@ -271,7 +267,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                 PLpgSQL_stmt_assign* assignment  = ((PLpgSQL_stmt_assign*)stmt);
 
                 /* Set the wites variables of the statement to the variable the assignment writes */
-                setIGraphNodeAttrP(igraph,"write",nodeid,bms_copy(bms_make_singleton(assignment->varno)));
+                graph->writes[nodeid] = bms_copy(bms_make_singleton(assignment->varno));
 
                 /* Get the parameters of the query of the assignment. Those are our read variables */
                 Bitmapset* bms = bms_copy(getParametersOfQueryExpr( assignment->expr,
@@ -280,7 +276,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     function,
                                                                     estate));
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+                graph->reads[nodeid] = bms;
                 break;
             }
             case PLPGSQL_STMT_RAISE:{
@@ -296,7 +292,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     function,
                                                                     estate));
                  /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+                graph->reads[nodeid] = bms;
                 break;
             }
             case PLPGSQL_STMT_WHILE:{
@@ -310,7 +306,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     function,
                                                                     estate));
                 /* Set the read variables of the statement */
-               setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+               graph->reads[nodeid] = bms;
                 break;
             }
             case PLPGSQL_STMT_FORI:{
@@ -345,13 +341,13 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     estate));
 
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+                graph->reads[nodeid] = bms;
 
 
 
                 if(foriStmt->var->dtype == PLPGSQL_DTYPE_VAR){
                     /* Set the write variables of the statement */
-                    setIGraphNodeAttrP(igraph,"write",nodeid,bms_copy(bms_make_singleton(foriStmt->var->dno)));
+                    graph->writes[nodeid] = bms_copy(bms_make_singleton(foriStmt->var->dno));
                 }
 
                 break;
@@ -368,7 +364,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
 
 
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+                graph->reads[nodeid] = bms;
 
 
 
@@ -376,10 +372,10 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                     /* get the variables the fors stmt writes as Bitmapset and set them as our write variables */
                     Bitmapset* bmsWrite = intArrayToBitmapSet(forsStmt->row->varnos,forsStmt->row->nfields);
 
-                    setIGraphNodeAttrP(igraph,"write",nodeid,bmsWrite);
+                    graph->writes[nodeid] = bmsWrite;
                 }
                 else if(forsStmt->rec){
-                    setIGraphNodeAttrP(igraph,"write",nodeid,bms_copy(bms_make_singleton(forsStmt->rec->dno)));
+                    graph->writes[nodeid] = bms_copy(bms_make_singleton(forsStmt->rec->dno));
                 }
 
 
@@ -398,10 +394,10 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
 
 
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+                graph->reads[nodeid] = bms;
 
 
-                setIGraphNodeAttrP(igraph,"write",nodeid,bms_copy(bms_make_singleton(foreachStmt->varno)));
+                graph->writes[nodeid] = bms_copy(bms_make_singleton(foreachStmt->varno));
 
 
                 break;
@@ -416,7 +412,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     function,
                                                                     estate));
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bms);
+                graph->reads[nodeid] = bms;
                 break;
             }
             case PLPGSQL_STMT_EXECSQL:{
@@ -429,10 +425,10 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                     if(execSqlStmt->row){
                         /* get the variables the exec stmt writes as Bitmapset and set them as our write variables */
                         Bitmapset* bmsWrite = intArrayToBitmapSet(execSqlStmt->row->varnos,execSqlStmt->row->nfields);
-                        setIGraphNodeAttrP(igraph,"write",nodeid,bmsWrite);
+                        graph->writes[nodeid] = bmsWrite;
                     }
                     else if(execSqlStmt->rec){
-                        setIGraphNodeAttrP(igraph,"write",nodeid,bms_copy(bms_make_singleton(execSqlStmt->rec->dno)));
+                        graph->writes[nodeid] = bms_copy(bms_make_singleton(execSqlStmt->rec->dno));
                     }
                 }
 
@@ -443,7 +439,7 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     function,
                                                                     estate));
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bmsRead);
+                graph->reads[nodeid] = bmsRead;
 
 
                 break;
@@ -457,156 +453,180 @@ void setReadsAndWrites(int nodeid, igraph_t* igraph){
                                                                     function,
                                                                     estate));
                 /* Set the read variables of the statement */
-                setIGraphNodeAttrP(igraph,"read",nodeid,bmsRead);
+                graph->reads[nodeid] = bmsRead;
                 break;
             }
             default:
                 break;
         }
     }
-
-
 }
 
 
-
 /**
- * Add WR, RW and WW dependence edges to the reachable nodes of the current node
+ * sets the reads and writes of statements in the graph nodes
  */
-void addDependenceEges(igraph_t* igraph, long nodeid, Datum* argument, Datum* result, bool lastElem){
-
-
-    Bitmapset* writeBms1 = getIGraphNodeAttrP(igraph,"write",nodeid);
-    Bitmapset* readBms1 = getIGraphNodeAttrP(igraph,"read",nodeid);
-    PLpgSQL_datum**         datums = getIGraphGlobalAttrP(igraph,"datums");
+void setReadsAndWrites(int nodeid, PLGraph* graph){
 
-    if(nodeid == 0 || (writeBms1 == NULL && readBms1 == NULL)){
+    if(nodeid == 0)
         return;
-    }
 
+    PLpgSQL_stmt* stmt = graph->stmts[nodeid];
+    MemoryContext oldcontext = CurrentMemoryContext;
+    ResourceOwner oldowner = CurrentResourceOwner;
+    bool failed = false;
 
-    /* reachable nodes in dfs fashion */
-    igraph_vector_t order;
-    igraph_vector_init(&order, 0);
-    igraph_dfs(igraph, /*root=*/nodeid, /*neimode=*/IGRAPH_OUT,
-            /*unreachable=*/0, &order, 0, 0, 0, 0, 0,0);
-
+    graph->reads[nodeid] = NULL;
+    graph->writes[nodeid] = NULL;
 
+    /* unchanged statements of a replaced function are not parsed again */
+    uint64 hash = stmt ? hashStmt(stmt,graph->function) : 0;
+    if(lookupStmtMemo(hash,&graph->reads[nodeid],&graph->writes[nodeid])){
+        graph->stmtHashes[nodeid] = hash;
+        return;
+    }
 
-    /* iterate over reachable edges of the current node in dfs fashion */
-    for(int i=0;order.stor_begin != NULL && i<igraph_vector_size(&order);i++){
-        /* current vertex id */
-        unsigned int vid = VECTOR(order)[i];
+    /*
+     * A query that does not parse must not fail the captured call. Like an
+     * exception block of plpgsql the statement is analyzed in a
+     * subtransaction, which cleans up after an error. Errors of the query
+     * itself leave the statement without reads and writes and count it as
+     * unsupported, all other errors are thrown again.
+     */
+    BeginInternalSubTransaction(NULL);
+    MemoryContextSwitchTo(oldcontext);
+
+    PG_TRY();
+    {
+        collectReadsAndWrites(nodeid,graph);
+
+        ReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(oldcontext);
+        CurrentResourceOwner = oldowner;
+    }
+    PG_CATCH();
+    {
+        ErrorData* edata;
 
-        if(nodeid != vid){
-            Bitmapset* readBms2 = getIGraphNodeAttrP(igraph,"read",vid);
-            Bitmapset* writeBms2 = getIGraphNodeAttrP(igraph,"write",vid);
+        MemoryContextSwitchTo(oldcontext);
+        edata = CopyErrorData();
+        FlushErrorState();
 
-            if(containsSameVariable(writeBms1,readBms2,datums)){
-                /* read -> write dependency, add edge */
-                addEdgeWithAttr(igraph,nodeid,vid,"type","WR-DEPENDENCE");
-            }
+        RollbackAndReleaseCurrentSubTransaction();
+        MemoryContextSwitchTo(oldcontext);
+        CurrentResourceOwner = oldowner;
 
+        if(ERRCODE_TO_CATEGORY(edata->sqlerrcode) != ERRCODE_SYNTAX_ERROR_OR_ACCESS_RULE_VIOLATION &&
+           edata->sqlerrcode != ERRCODE_FEATURE_NOT_SUPPORTED)
+            ReThrowError(edata);
 
-            if(containsSameVariable(writeBms1,writeBms2,datums)){
-                /* write -> write dependency, add edge */
-                addEdgeWithAttr(igraph,nodeid,vid,"type","WW-DEPENDENCE");
-            }
-
+        FreeErrorData(edata);
+        failed = true;
+    }
+    PG_END_TRY();
 
-            if(containsSameVariable(readBms1,writeBms2,datums)){
-                /* write -> read dependency, add edge */
-                addEdgeWithAttr(igraph,nodeid,vid,"type","RW-DEPENDENCE");
-            }
-        }
+    if(failed){
+        graph->reads[nodeid] = NULL;
+        graph->writes[nodeid] = NULL;
+        graph->nunsupported++;
+        return;
     }
-    igraph_vector_destroy(&order);
 
+    graph->stmtHashes[nodeid] = hash;
+    storeStmtMemo(hash,graph->reads[nodeid],graph->writes[nodeid]);
 }
 
 
-/**
- * Add dependency eges to the Graph and therefore create a program dependence graph
- */
-void addProgramDependenceEdges(igraph_t* igraph){
-    iterateIGraphNodes(igraph,&addDependenceEges,NULL,NULL,0);
-}
-
 
 /**
- * if the statement of the current node equals the given node set the result to the node number
+ * Add dependency eges to the Graph and therefore create a program dependence graph
  */
-void retrieveNodeNumber(igraph_t* igraph, long nodeId, Datum* argument, Datum* result, bool lastElem){
-    PLpgSQL_stmt* argStmt = (PLpgSQL_stmt*)DatumGetPointer(*argument);
-
-    PLpgSQL_stmt* stmt = getIGraphNodeAttrP(igraph,"stmt",nodeId);
+void addProgramDependenceEdges(PLGraph* graph){
 
+    /* solved over the components of the flow graph, which stay with the graph */
+    addDataflowDependenceEdges(graph);
 
-    if(argStmt == stmt){
-        Datum datum = Int64GetDatum(nodeId);
-        *result = datum;
-    }
+    /* adjacency including the dependence edges */
+    buildGraphAdjacency(graph);
 
+    /* node pairs with a dependence edge, for conflict tests */
+    buildDependenceIndex(graph);
 }
 
 
-long getNodeNumberToStmt(PLpgSQL_stmt* stmt1, igraph_t* graph){
-    Datum stmt     = PointerGetDatum(stmt1);
-    Datum resDatum = PointerGetDatum(NULL);
-
+/**
+ * returns the node of the given statement or -1 if there is none
+ */
+long getNodeNumberToStmt(PLpgSQL_stmt* stmt1, PLGraph* graph){
 
-    iterateIGraphNodes(graph,&retrieveNodeNumber,&stmt,&resDatum,1);
+    /* graphs built by buildGraph have the statement index */
+    if(graph->stmtSlots != NULL)
+        return lookupStmtNode(graph,stmt1);
 
-    return DatumGetInt64(resDatum);
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
+        if(graph->stmts[nodeid] == stmt1)
+            return nodeid;
+    }
+    return -1;
 }
 
 
 
-int dependenceConflict(int node1, int node2, igraph_t* igraph){
+int dependenceConflict(int node1, int node2, PLGraph* graph){
 
     /* if there is no node for the statement we must assume a conflict */
     if(node1 == -1 || node2 == -1){
         return 1;
     }
 
-    int retval = 0;
-
-
-    /* iterate incident edges */
-    igraph_vector_t eids;
-    igraph_vector_init(&eids,0);
-    igraph_incident(igraph, &eids,node1, IGRAPH_OUT);
-
-    for(int i=0;i<igraph_vector_size(&eids);i++){
-        int eid = VECTOR(eids)[i];
-        igraph_integer_t from; igraph_integer_t to;
-        igraph_edge(igraph, eid,&from,&to);
-
-        /* found a edge from the first to the second node */
-        if(to == node2){
-            const char* type = getIGraphEdgeAttrS(igraph,"type",eid);
-            /* check if type is set */
-            if(type){
-                /* DEPENDENCY */
-                if( strcmp(type,"RW-DEPENDENCE") == 0 ||
-                    strcmp(type,"WR-DEPENDENCE") == 0 ||
-                    strcmp(type,"WW-DEPENDENCE") == 0)    {
-                    retval = 1;
-                    break;
-                }
-            }
+    /* the dependence index is built with the dependence edges */
+    if(graph->depSlots != NULL){
+        return hasDependenceEdge(graph,node1,node2) ? 1 : 0;
+    }
+
+    int* eids = GraphOutEdges(graph,node1);
+
+    /* iterate outgoing edges */
+    for(int i=0;i<GraphOutDegree(graph,node1);i++){
+        int eid = eids[i];
+
+        /* found a dependence edge from the first to the second node */
+        if(graph->edgeTo[eid] == node2 && graph->edgeKind[eid] != EDGE_FLOW){
+            return 1;
         }
     }
-    igraph_vector_destroy(&eids);
-    return retval;
+    return 0;
 }
 
 
-int conflict(PLpgSQL_stmt* stmt1, PLpgSQL_stmt* stmt2, igraph_t* igraph){
-    int node1 = getNodeNumberToStmt(stmt1,igraph);
-    int node2 = getNodeNumberToStmt(stmt2,igraph);
-    return dependenceConflict(node1,node2,igraph);
+int conflict(PLpgSQL_stmt* stmt1, PLpgSQL_stmt* stmt2, PLGraph* graph){
+    int node1 = getNodeNumberToStmt(stmt1,graph);
+    int node2 = getNodeNumberToStmt(stmt2,graph);
+    return dependenceConflict(node1,node2,graph);
 
 }
 
 
+/**
+ * conflicts between all pairs of the given statements. Returns a
+ * nstmts x nstmts matrix in row major order, entry i*nstmts+j tells
+ * whether stmts[i] conflicts with stmts[j]. The statements are looked
+ * up once instead of once per pair.
+ */
+bool* conflictMatrix(PLpgSQL_stmt** stmts, int nstmts, PLGraph* graph){
+    bool* matrix = palloc(Max(nstmts * nstmts,1) * sizeof(bool));
+    int* nodes = palloc(Max(nstmts,1) * sizeof(int));
+
+    for(int i=0;i<nstmts;i++){
+        nodes[i] = getNodeNumberToStmt(stmts[i],graph);
+    }
+
+    for(int i=0;i<nstmts;i++){
+        for(int j=0;j<nstmts;j++){
+            matrix[i * nstmts + j] = dependenceConflict(nodes[i],nodes[j],graph) != 0;
+        }
+    }
+
+    pfree(nodes);
+    return matrix;
+}
@@ -3,7 +3,6 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <igraph/igraph.h>
 #include "pl_graphs.h"
 
 
@@ -24,6 +23,7 @@ struct graph_status* initStatus(int initnodeid){
     struct graph_status* status = palloc(sizeof(struct graph_status));
     status->nodes = nodes;
     status->parents = parents;
+    status->unsupported = 0;
 
     return status;
 
@@ -231,7 +231,8 @@ void createProgramGraph(int* newnodeid,
                 appendNewNodeAndConnectParents(newnodeid,status,stmt);
                 break;
             default:
-                printf("Unsupported Statement %i\n",stmt->cmd_type);
+                elog(DEBUG1,"Unsupported Statement %i",stmt->cmd_type);
+                status->unsupported++;
                 break;
         }
 
@@ -239,40 +240,23 @@ void createProgramGraph(int* newnodeid,
 }
 
 /**
- * Build the igraph
+ * Build the graph
  */
-igraph_t* buildIGraph(List* nodes,
-                      PLpgSQL_datum**         datums,
-                      int                     ndatums,
-                      PLpgSQL_function* function,
-                      PLpgSQL_execstate * estate){
+PLGraph* buildGraph(List* nodes,
+                    PLpgSQL_datum**         datums,
+                    int                     ndatums,
+                    PLpgSQL_function* function,
+                    PLpgSQL_execstate * estate){
 
-    /* init a new igraph */
-    igraph_t* graph = palloc(sizeof(igraph_t));
-    /* init the edges */
-    igraph_vector_t graphedges;
-    igraph_vector_init(&graphedges, 0);
-
-    /* turn on attribute handling */
-    igraph_i_set_attribute_table(&igraph_cattribute_table);
-
-    igraph_empty(graph,nodes->length,1);
-
-    setIGraphGlobalAttrP(graph,"function",function);
-    setIGraphGlobalAttrP(graph,"estate",estate);
-    setIGraphGlobalAttrP(graph,"datums",datums);
-    setIGraphGlobalAttrL(graph,"ndatums",ndatums);
+    /* init a new graph */
+    PLGraph* graph = initGraph(list_length(nodes),datums,ndatums,function,estate);
 
     ListCell* node;
     /* iterate over nodes */
     foreach(node, nodes){
         struct node* no = lfirst(node);
 
-
-        setIGraphNodeAttrP(graph,"stmt",no->key,no->stmt);
-
-        setReadsAndWrites(no->key,graph);
-
+        graph->stmts[no->key] = no->stmt;
 
         ListCell* e;
         /* iterate over outgoing edges of the current node */
@@ -280,40 +264,38 @@ igraph_t* buildIGraph(List* nodes,
             struct edge* edge = lfirst(e);
 
             /* Add edges to the graph */
-            igraph_add_edge(graph,
-                            edge->sourceid,
-                            edge->targetid);
+            addGraphEdge(graph,
+                         edge->sourceid,
+                         edge->targetid,
+                         EDGE_FLOW);
+        }
+    }
 
-            igraph_integer_t eid;
-            igraph_get_eid(graph,
-                           &eid,
-                           edge->sourceid,
-                           edge->targetid,
-                           1,
-                           0);
+    buildGraphAdjacency(graph);
 
-            setIGraphEdgeAttrS(graph,"type",eid,"FLOW");
+    /* iterate over nodes */
+    for(int nodeid=0;nodeid<graph->nnodes;nodeid++){
 
-        }
+        setReadsAndWrites(nodeid,graph);
 
         /* Add the labels to the current node and outgoing edges */
-        addLabels(no->key,graph);
-
+        addLabels(nodeid,graph);
     }
 
+    /* who reads and writes which variable */
+    buildVariableIndex(graph);
 
-
+    /* which node belongs to a statement */
+    buildStmtIndex(graph);
 
     return graph;
 }
 
-igraph_t* createFlowGraph(
+PLGraph* createFlowGraph(
                             PLpgSQL_datum**         datums,
                             int                     ndatums,
                             PLpgSQL_function* function,
                             PLpgSQL_execstate *estate){
-    /* ignore errors */
-    igraph_set_error_handler(igraph_error_handler_printignore);
 
     int newnodeid = 0;
     struct graph_status* status  = initStatus(newnodeid);
@@ -321,8 +303,11 @@ igraph_t* createFlowGraph(
     createProgramGraph(&newnodeid,status,function->action->body,function);
 
 
-    /* convert the graph to an igraph */
-    return buildIGraph(status->nodes,datums,ndatums,function,estate);
+    /* convert the node list to a graph */
+    PLGraph* graph = buildGraph(status->nodes,datums,ndatums,function,estate);
+    /* statements whose queries could not be parsed are counted already */
+    graph->nunsupported += status->unsupported;
 
-}
+    return graph;
 
+}
@@ -0,0 +1,314 @@
+#include "plpgsql.h"
+#include "nodes/pg_list.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "pl_graphs.h"
+
+
+/*
+ * Reachability closure of the flow graph.
+ *
+ * The strongly connected components are found with an iterative version
+ * of Tarjan's algorithm, which emits them in reverse topological order.
+ * In that order the row of a component is the OR of the rows and members
+ * of its successor components, so every row is final when it is used.
+ * Rows are kept per component, not per node, so loops do not cost extra
+ * rows. Without the closure, or above MAXREACHABILITYSIZE bytes, no matrix
+ * is built and the questions are answered by a search over the condensed
+ * graph. The dataflow analysis only needs the components, it solves them
+ * one after the other in topological order.
+ */
+
+
+/**
+ * ORs the row src into dst
+ */
+static inline void orRow(uint64* dst, const uint64* src, int nwords){
+    int w = 0;
+
+#if defined(__SSE2__)
+    for(;w + 2 <= nwords;w += 2){
+        __m128i a = _mm_loadu_si128((const __m128i*) (dst + w));
+        __m128i b = _mm_loadu_si128((const __m128i*) (src + w));
+        _mm_storeu_si128((__m128i*) (dst + w), _mm_or_si128(a, b));
+    }
+#endif
+    for(;w<nwords;w++)
+        dst[w] |= src[w];
+}
+
+
+/**
+ * Finds the strongly connected components in reverse topological order
+ * and builds the condensed graph
+ */
+static void condenseGraph(GraphReachability* reach, int nedges, const int* edgeFrom, const int* edgeTo){
+    int     nnodes = reach->nnodes;
+    int*    outStart = palloc0((nnodes + 1) * sizeof(int));
+    int*    outNodes = palloc(Max(nedges,1) * sizeof(int));
+    int*    next = palloc(Max(nnodes,1) * sizeof(int));
+    int*    index = palloc(Max(nnodes,1) * sizeof(int));
+    int*    lowlink = palloc(Max(nnodes,1) * sizeof(int));
+    int*    stack = palloc(Max(nnodes,1) * sizeof(int));
+    int*    callStack = palloc(Max(nnodes,1) * sizeof(int));
+    bool*   onStack = palloc0(Max(nnodes,1) * sizeof(bool));
+    bool*   selfLoop = palloc0(Max(nnodes,1) * sizeof(bool));
+    int     nstack = 0;
+    int     ncall = 0;
+    int     counter = 0;
+
+    /* adjacency of the nodes */
+    for(int e=0;e<nedges;e++)
+        outStart[edgeFrom[e] + 1]++;
+    for(int n=0;n<nnodes;n++)
+        outStart[n + 1] += outStart[n];
+    memcpy(next, outStart, nnodes * sizeof(int));
+    for(int e=0;e<nedges;e++)
+        outNodes[next[edgeFrom[e]]++] = edgeTo[e];
+
+    reach->ncomponents = 0;
+    reach->component = palloc(Max(nnodes,1) * sizeof(int));
+    reach->cyclic = palloc0(Max(nnodes,1) * sizeof(bool));
+    for(int n=0;n<nnodes;n++)
+        index[n] = -1;
+
+    /* tarjan, the call stack is simulated with next as edge position */
+    for(int root=0;root<nnodes;root++){
+        if(index[root] >= 0)
+            continue;
+
+        index[root] = lowlink[root] = counter++;
+        next[root] = outStart[root];
+        stack[nstack++] = root;
+        onStack[root] = true;
+        callStack[ncall++] = root;
+
+        while(ncall > 0){
+            int n = callStack[ncall - 1];
+
+            if(next[n] < outStart[n + 1]){
+                int to = outNodes[next[n]++];
+
+                if(to == n){
+                    selfLoop[n] = true;
+                }
+                else if(index[to] < 0){
+                    index[to] = lowlink[to] = counter++;
+                    next[to] = outStart[to];
+                    stack[nstack++] = to;
+                    onStack[to] = true;
+                    callStack[ncall++] = to;
+                }
+                else if(onStack[to]){
+                    lowlink[n] = Min(lowlink[n], index[to]);
+                }
+                continue;
+            }
+
+            /* all successors done, n is the root of a component */
+            if(lowlink[n] == index[n]){
+                int c = reach->ncomponents++;
+                int m;
+                int size = 0;
+                bool cyclic = false;
+
+                do{
+                    m = stack[--nstack];
+                    onStack[m] = false;
+                    reach->component[m] = c;
+                    cyclic |= selfLoop[m];
+                    size++;
+                }while(m != n);
+
+                /* a component is cyclic with more than one node or a self loop */
+                reach->cyclic[c] = cyclic || size > 1;
+            }
+
+            ncall--;
+            if(ncall > 0){
+                int parent = callStack[ncall - 1];
+                lowlink[parent] = Min(lowlink[parent], lowlink[n]);
+            }
+        }
+    }
+
+    /* members of the components as CSR */
+    reach->memberStart = palloc0((reach->ncomponents + 1) * sizeof(int));
+    reach->members = palloc(Max(nnodes,1) * sizeof(int));
+    for(int n=0;n<nnodes;n++)
+        reach->memberStart[reach->component[n] + 1]++;
+    for(int c=0;c<reach->ncomponents;c++)
+        reach->memberStart[c + 1] += reach->memberStart[c];
+    memcpy(next, reach->memberStart, reach->ncomponents * sizeof(int));
+    for(int n=0;n<nnodes;n++)
+        reach->members[next[reach->component[n]]++] = n;
+
+    /* edges between the components */
+    reach->succStart = palloc0((reach->ncomponents + 1) * sizeof(int));
+    reach->succs = palloc(Max(nedges,1) * sizeof(int));
+    for(int c=0, nsuccs=0;c<reach->ncomponents;c++){
+        reach->succStart[c] = nsuccs;
+        for(int i=reach->memberStart[c];i<reach->memberStart[c + 1];i++){
+            int n = reach->members[i];
+
+            for(int e=outStart[n];e<outStart[n + 1];e++){
+                int to = reach->component[outNodes[e]];
+
+                if(to != c)
+                    reach->succs[nsuccs++] = to;
+            }
+        }
+        reach->succStart[c + 1] = nsuccs;
+    }
+
+    pfree(outStart);
+    pfree(outNodes);
+    pfree(next);
+    pfree(index);
+    pfree(lowlink);
+    pfree(stack);
+    pfree(callStack);
+    pfree(onStack);
+    pfree(selfLoop);
+}
+
+
+/**
+ * Computes the reachability relation of a graph given by its edges, with
+ * the closure matrix if closure is set
+ */
+GraphReachability* computeReachability(int nnodes, int nedges, const int* edgeFrom, const int* edgeTo, bool closure){
+    GraphReachability* reach = palloc0(sizeof(GraphReachability));
+
+    reach->nnodes = nnodes;
+    reach->nwords = (nnodes + 63) / 64;
+
+    condenseGraph(reach,nedges,edgeFrom,edgeTo);
+
+    /* not wanted or too large for a matrix, use the search over the condensed graph */
+    if(!closure ||
+       (Size) reach->ncomponents * reach->nwords * sizeof(uint64) > MAXREACHABILITYSIZE){
+        reach->rows = NULL;
+        return reach;
+    }
+
+    reach->rows = palloc0(Max((Size) reach->ncomponents * reach->nwords,1) * sizeof(uint64));
+
+    /* successors come first in reverse topological order */
+    for(int c=0;c<reach->ncomponents;c++){
+        uint64* row = reach->rows + (Size) c * reach->nwords;
+
+        for(int s=reach->succStart[c];s<reach->succStart[c + 1];s++){
+            int     succ = reach->succs[s];
+            uint64* succRow = reach->rows + (Size) succ * reach->nwords;
+
+            orRow(row, succRow, reach->nwords);
+            for(int i=reach->memberStart[succ];i<reach->memberStart[succ + 1];i++){
+                int m = reach->members[i];
+                row[m / 64] |= ((uint64) 1) << (m % 64);
+            }
+        }
+
+        /* the nodes of a loop reach each other and themselves */
+        if(reach->cyclic[c]){
+            for(int i=reach->memberStart[c];i<reach->memberStart[c + 1];i++){
+                int m = reach->members[i];
+                row[m / 64] |= ((uint64) 1) << (m % 64);
+            }
+        }
+    }
+
+    return reach;
+}
+
+
+/**
+ * Computes the reachability relation over the flow edges of a graph
+ */
+GraphReachability* computeFlowReachability(PLGraph* graph, bool closure){
+    int*                from = palloc(Max(graph->nedges,1) * sizeof(int));
+    int*                to = palloc(Max(graph->nedges,1) * sizeof(int));
+    int                 nflow = 0;
+    GraphReachability*  reach;
+
+    for(int eid=0;eid<graph->nedges;eid++){
+        if(graph->edgeKind[eid] == EDGE_FLOW){
+            from[nflow] = graph->edgeFrom[eid];
+            to[nflow] = graph->edgeTo[eid];
+            nflow++;
+        }
+    }
+
+    reach = computeReachability(graph->nnodes,nflow,from,to,closure);
+
+    pfree(from);
+    pfree(to);
+    return reach;
+}
+
+
+/**
+ * true if there is a path of at least one edge from one node to the other
+ */
+bool isReachable(GraphReachability* reach, int from, int to){
+    int     source = reach->component[from];
+    int     target = reach->component[to];
+    bool*   visited;
+    int*    stack;
+    int     nstack = 0;
+    bool    found = false;
+
+    if(source == target)
+        return reach->cyclic[source];
+
+    if(reach->rows != NULL)
+        return (reach->rows[(Size) source * reach->nwords + to / 64] >> (to % 64)) & 1;
+
+    /* search the condensed graph, components are in reverse topological order */
+    visited = palloc0(reach->ncomponents * sizeof(bool));
+    stack = palloc(reach->ncomponents * sizeof(int));
+    stack[nstack++] = source;
+    visited[source] = true;
+
+    while(nstack > 0 && !found){
+        int c = stack[--nstack];
+
+        for(int s=reach->succStart[c];s<reach->succStart[c + 1];s++){
+            int succ = reach->succs[s];
+
+            if(succ == target){
+                found = true;
+                break;
+            }
+            /* successors have smaller ids, the target can not be behind c */
+            if(!visited[succ] && succ > target){
+                visited[succ] = true;
+                stack[nstack++] = succ;
+            }
+        }
+    }
+
+    pfree(visited);
+    pfree(stack);
+    return found;
+}
+
+
+/**
+ * frees the reachability relation
+ */
+void destroyReachability(GraphReachability* reach){
+    pfree(reach->component);
+    pfree(reach->cyclic);
+    pfree(reach->memberStart);
+    pfree(reach->members);
+    pfree(reach->succStart);
+    pfree(reach->succs);
+    if(reach->rows != NULL)
+        pfree(reach->rows);
+    pfree(reach);
+}
@@ -0,0 +1,295 @@
+#include "plpgsql.h"
+#include "nodes/pg_list.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "pl_graphs.h"
+
+
+/*
+ * Memo of the read and write sets of statements.
+ *
+ * Finding the variables a statement reads means raw parsing its queries,
+ * which dominates the time to build the graphs of a large function. When
+ * a function is replaced most of its statements are unchanged, so the sets
+ * are remembered per process under a structural hash of the statement:
+ * its kind, the text of its queries, the namespace the queries are
+ * resolved in and the variables it assigns. Statements with the same hash
+ * get the same sets, wherever they are in the function. The memo lives as
+ * long as the process, it is dropped as a whole when it is full.
+ *
+ * The hashes are kept in the stored graph image as well, so a process
+ * that did not build the previous version of a function, like a newly
+ * started background worker, seeds the memo from its image.
+ */
+
+/* hashes are salted, so a change of the memo layout does not match old hashes */
+#define STMT_MEMO_SEED      UINT64CONST(0x706c5f6d656d6f32)
+
+typedef struct StmtMemoEntry{
+    uint64      hash;           /* structural hash of the statement, the key */
+    Bitmapset*  reads;          /* datums read by the statement */
+    Bitmapset*  writes;         /* datums written by the statement */
+} StmtMemoEntry;
+
+static MemoryContext stmtMemoContext = NULL;
+static HTAB* stmtMemo = NULL;
+
+
+/**
+ * mixes len bytes into the hash, FNV-1a
+ */
+static uint64 hashBytes(uint64 h, const void* data, Size len){
+    const unsigned char* bytes = data;
+
+    for(Size i=0;i<len;i++){
+        h ^= bytes[i];
+        h *= UINT64CONST(0x100000001b3);
+    }
+    return h;
+}
+
+static inline uint64 hashInt(uint64 h, int32 value){
+    return hashBytes(h,&value,sizeof(value));
+}
+
+static inline uint64 hashString(uint64 h, const char* s){
+    if(s == NULL)
+        return hashInt(h,-1);
+    /* the terminator separates consecutive strings */
+    return hashBytes(h,s,strlen(s) + 1);
+}
+
+
+/**
+ * mixes in a query and everything its referenced datums are resolved by
+ */
+static uint64 hashExpr(uint64 h, PLpgSQL_expr* expr, PLpgSQL_function* function){
+    PLpgSQL_nsitem* item;
+
+    if(expr == NULL)
+        return hashInt(h,-1);
+
+    h = hashString(h,expr->query);
+
+    /* names are resolved in the namespace of the query */
+    for(item = expr->ns; item != NULL; item = item->prev){
+        h = hashInt(h,item->itemtype);
+        h = hashInt(h,item->itemno);
+        h = hashString(h,item->name);
+
+        /* record and row fields resolve to datums of their own */
+        if(item->itemtype == PLPGSQL_NSTYPE_REC){
+            for(int dno=0;dno<function->ndatums;dno++){
+                PLpgSQL_recfield* field = (PLpgSQL_recfield*) function->datums[dno];
+
+                if(field->dtype == PLPGSQL_DTYPE_RECFIELD && field->recparentno == item->itemno){
+                    h = hashInt(h,dno);
+                    h = hashString(h,field->fieldname);
+                }
+            }
+        }
+        else if(item->itemtype == PLPGSQL_NSTYPE_ROW){
+            PLpgSQL_row* row = (PLpgSQL_row*) function->datums[item->itemno];
+
+            for(int i=0;i<row->nfields;i++){
+                h = hashInt(h,row->varnos[i]);
+                h = hashString(h,row->fieldnames[i]);
+            }
+        }
+    }
+    return hashInt(h,-1);
+}
+
+static uint64 hashVarnos(uint64 h, int* varnos, int nfields){
+    h = hashInt(h,nfields);
+    for(int i=0;i<nfields;i++)
+        h = hashInt(h,varnos[i]);
+    return h;
+}
+
+
+/**
+ * Structural hash of the parts of a statement its read and write sets are
+ * computed from. Returns 0 for statements whose sets are not worth to be
+ * remembered.
+ */
+uint64 hashStmt(PLpgSQL_stmt* stmt, PLpgSQL_function* function){
+    uint64 h = STMT_MEMO_SEED;
+
+    if(stmt == NULL)
+        return 0;
+
+    /* with variable_conflict = use_column the sets depend on the tables */
+    if(function->resolve_option == PLPGSQL_RESOLVE_COLUMN)
+        return 0;
+
+    h = hashInt(h,stmt->cmd_type);
+
+    /* $n parameters refer to the arguments */
+    h = hashVarnos(h,function->fn_argvarnos,function->fn_nargs);
+
+    switch(stmt->cmd_type){
+        case PLPGSQL_STMT_ASSIGN:{
+            PLpgSQL_stmt_assign* assignment = (PLpgSQL_stmt_assign*) stmt;
+            h = hashInt(h,assignment->varno);
+            h = hashExpr(h,assignment->expr,function);
+            break;
+        }
+        case PLPGSQL_STMT_IF:
+            h = hashExpr(h,((PLpgSQL_stmt_if*) stmt)->cond,function);
+            break;
+        case PLPGSQL_STMT_WHILE:
+            h = hashExpr(h,((PLpgSQL_stmt_while*) stmt)->cond,function);
+            break;
+        case PLPGSQL_STMT_FORI:{
+            PLpgSQL_stmt_fori* foriStmt = (PLpgSQL_stmt_fori*) stmt;
+            h = hashExpr(h,foriStmt->lower,function);
+            h = hashExpr(h,foriStmt->upper,function);
+            h = hashExpr(h,foriStmt->step,function);
+            h = hashInt(h,foriStmt->var->dtype);
+            h = hashInt(h,foriStmt->var->dno);
+            break;
+        }
+        case PLPGSQL_STMT_FORS:{
+            PLpgSQL_stmt_fors* forsStmt = (PLpgSQL_stmt_fors*) stmt;
+            h = hashExpr(h,forsStmt->query,function);
+            if(forsStmt->row)
+                h = hashVarnos(h,forsStmt->row->varnos,forsStmt->row->nfields);
+            else
+                h = hashInt(h,forsStmt->rec ? forsStmt->rec->dno : -1);
+            break;
+        }
+        case PLPGSQL_STMT_FOREACH_A:{
+            PLpgSQL_stmt_foreach_a* foreachStmt = (PLpgSQL_stmt_foreach_a*) stmt;
+            h = hashExpr(h,foreachStmt->expr,function);
+            h = hashInt(h,foreachStmt->varno);
+            break;
+        }
+        case PLPGSQL_STMT_RETURN:
+            h = hashExpr(h,((PLpgSQL_stmt_return*) stmt)->expr,function);
+            break;
+        case PLPGSQL_STMT_EXECSQL:{
+            PLpgSQL_stmt_execsql* execSqlStmt = (PLpgSQL_stmt_execsql*) stmt;
+            h = hashExpr(h,execSqlStmt->sqlstmt,function);
+            h = hashInt(h,execSqlStmt->into);
+            if(execSqlStmt->row)
+                h = hashVarnos(h,execSqlStmt->row->varnos,execSqlStmt->row->nfields);
+            else
+                h = hashInt(h,execSqlStmt->rec ? execSqlStmt->rec->dno : -1);
+            break;
+        }
+        case PLPGSQL_STMT_PERFORM:
+            h = hashExpr(h,((PLpgSQL_stmt_perform*) stmt)->expr,function);
+            break;
+        default:
+            /* nothing is parsed for the other statements */
+            return 0;
+    }
+
+    /* 0 means no hash */
+    return h != 0 ? h : 1;
+}
+
+
+/**
+ * Looks up the read and write sets of a statement with the given hash and
+ * copies them to the current memory context. Returns false if they are
+ * not known.
+ */
+bool lookupStmtMemo(uint64 hash, Bitmapset** reads, Bitmapset** writes){
+    StmtMemoEntry* entry;
+
+    if(stmtMemo == NULL || hash == 0)
+        return false;
+
+    entry = (StmtMemoEntry*) hash_search(stmtMemo,&hash,HASH_FIND,NULL);
+    if(entry == NULL)
+        return false;
+
+    *reads = bms_copy(entry->reads);
+    *writes = bms_copy(entry->writes);
+    return true;
+}
+
+
+/**
+ * Remembers the read and write sets of a statement with the given hash
+ */
+void storeStmtMemo(uint64 hash, Bitmapset* reads, Bitmapset* writes){
+    StmtMemoEntry*  entry;
+    MemoryContext   oldcontext;
+    bool            found;
+
+    if(hash == 0)
+        return;
+
+    if(stmtMemoContext == NULL)
+        stmtMemoContext = AllocSetContextCreate(TopMemoryContext,
+                                                "pl_graphs statement memo",
+                                                ALLOCSET_DEFAULT_MINSIZE,
+                                                ALLOCSET_DEFAULT_INITSIZE,
+                                                ALLOCSET_DEFAULT_MAXSIZE);
+
+    /* start over when the memo is full */
+    if(stmtMemo != NULL && hash_get_num_entries(stmtMemo) >= STMT_MEMO_SIZE){
+        MemoryContextReset(stmtMemoContext);
+        stmtMemo = NULL;
+    }
+
+    if(stmtMemo == NULL){
+        HASHCTL info;
+
+        memset(&info, 0, sizeof(info));
+        info.keysize = sizeof(uint64);
+        info.entrysize = sizeof(StmtMemoEntry);
+        info.hcxt = stmtMemoContext;
+        stmtMemo = hash_create("pl_graphs statement memo", 1024, &info,
+                               HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
+
+    entry = (StmtMemoEntry*) hash_search(stmtMemo,&hash,HASH_ENTER,&found);
+    if(found)
+        return;
+
+    oldcontext = MemoryContextSwitchTo(stmtMemoContext);
+    entry->reads = bms_copy(reads);
+    entry->writes = bms_copy(writes);
+    MemoryContextSwitchTo(oldcontext);
+}
+
+
+/**
+ * Remembers the read and write sets of the statements of a stored graph,
+ * which are given by the readers and writers of its variables
+ */
+void seedStmtMemo(GraphImage* image){
+    GraphImageNode*     nodes = GraphImageNodes(image);
+    GraphImageVariable* variables = GraphImageVariables(image);
+    int32*              accesses = GraphImageAccesses(image);
+    Bitmapset**         reads = palloc0(Max(image->nnodes,1) * sizeof(Bitmapset*));
+    Bitmapset**         writes = palloc0(Max(image->nnodes,1) * sizeof(Bitmapset*));
+
+    for(int v=0;v<image->nvariables;v++){
+        GraphImageVariable* variable = &variables[v];
+        int32*              readers = &accesses[variable->start];
+        int32*              writers = readers + variable->nreaders;
+
+        for(int i=0;i<variable->nreaders;i++)
+            reads[readers[i]] = bms_add_member(reads[readers[i]],variable->dno);
+        for(int i=0;i<variable->nwriters;i++)
+            writes[writers[i]] = bms_add_member(writes[writers[i]],variable->dno);
+    }
+
+    for(int nodeid=0;nodeid<image->nnodes;nodeid++){
+        if(nodes[nodeid].stmtHash != 0)
+            storeStmtMemo(nodes[nodeid].stmtHash,reads[nodeid],writes[nodeid]);
+        bms_free(reads[nodeid]);
+        bms_free(writes[nodeid]);
+    }
+
+    pfree(reads);
+    pfree(writes);
+}
@@ -3,13 +3,267 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <igraph/igraph.h>
 #include "pl_graphs.h"
+#include "catalog/namespace.h"
 #include "catalog/pg_type.h"
+#include "nodes/nodeFuncs.h"
 #include "parser/parse_node.h"
+#include "parser/parser.h"
+#include "utils/lsyscache.h"
+
+
+/*
+ * State of collectReferencedDatums
+ */
+struct referenced_datums{
+    PLpgSQL_expr*       expr;
+    PLpgSQL_function*   function;
+    PLpgSQL_datum**     datums;
+    int                 ndatums;
+    List*               relations;      /* RangeVars of the query */
+    Bitmapset*          dnos;
+};
+
+
+/**
+ * Looks up a name of up to three parts in the namespace of an expression
+ * the way plpgsql_ns_lookup does. Sets nnames to the number of parts the
+ * item matched: 1 for an unqualified name, 2 for a block qualified one.
+ */
+static PLpgSQL_nsitem* lookupNamespaceItem(PLpgSQL_nsitem* ns,
+                                           const char* name1,
+                                           const char* name2,
+                                           const char* name3,
+                                           int* nnames){
+    while(ns != NULL){
+        PLpgSQL_nsitem* item;
+
+        /* unqualified match in this block */
+        for(item = ns; item->itemtype != PLPGSQL_NSTYPE_LABEL; item = item->prev){
+            if(strcmp(item->name,name1) == 0 &&
+               (name2 == NULL || item->itemtype != PLPGSQL_NSTYPE_VAR)){
+                *nnames = 1;
+                return item;
+            }
+        }
+
+        /* name qualified with the label of this block */
+        if(name2 != NULL && strcmp(item->name,name1) == 0){
+            PLpgSQL_nsitem* qualified;
+
+            for(qualified = ns; qualified->itemtype != PLPGSQL_NSTYPE_LABEL; qualified = qualified->prev){
+                if(strcmp(qualified->name,name2) == 0 &&
+                   (name3 == NULL || qualified->itemtype != PLPGSQL_NSTYPE_VAR)){
+                    *nnames = 2;
+                    return qualified;
+                }
+            }
+        }
+
+        ns = item->prev;
+    }
+    return NULL;
+}
+
+
+/**
+ * Checks whether a column reference names a column of one of the tables
+ * of the query. Only the tables are looked at, not subqueries or
+ * functions in FROM.
+ */
+static bool isTableColumn(ColumnRef* cref, struct referenced_datums* context){
+    int         nfields = list_length(cref->fields);
+    Node*       last = (Node*) llast(cref->fields);
+    char*       qualifier = NULL;
+    ListCell*   l;
+
+    if(!IsA(last, String) || nfields > 3)
+        return false;
+    if(nfields > 1)
+        qualifier = strVal(list_nth(cref->fields, nfields - 2));
+
+    foreach(l, context->relations){
+        RangeVar*   relation = (RangeVar*) lfirst(l);
+        Oid         relid;
+
+        if(qualifier != NULL &&
+           strcmp(qualifier, relation->alias ? relation->alias->aliasname : relation->relname) != 0)
+            continue;
+
+        relid = RangeVarGetRelid(relation, NoLock, true);
+        if(OidIsValid(relid) && get_attnum(relid, strVal(last)) != InvalidAttrNumber)
+            return true;
+    }
+    return false;
+}
+
 
 /**
- * Workaround to get the parameters of a query as Bitmapset
+ * Resolves a column reference to the datum plpgsql would substitute for
+ * it, following resolve_column_ref of plpgsql. Returns -1 if it does not
+ * refer to a datum.
+ */
+static int resolveColumnRef(ColumnRef* cref, struct referenced_datums* context){
+    const char* name1;
+    const char* name2 = NULL;
+    const char* name3 = NULL;
+    const char* colname = NULL;
+    int         nnames;
+    int         nnamesScalar = 0;
+    int         nnamesWholerow = 0;
+    int         nnamesField = 0;
+    PLpgSQL_nsitem* item;
+
+    switch(list_length(cref->fields)){
+        case 1:
+            name1 = strVal(linitial(cref->fields));
+            nnamesScalar = 1;
+            nnamesWholerow = 1;
+            break;
+        case 2:
+            name1 = strVal(linitial(cref->fields));
+            /* a whole row reference does not match scalar variables */
+            if(IsA(lsecond(cref->fields), A_Star)){
+                name2 = "*";
+                nnamesWholerow = 1;
+                break;
+            }
+            name2 = strVal(lsecond(cref->fields));
+            colname = name2;
+            nnamesScalar = 2;
+            nnamesWholerow = 2;
+            nnamesField = 1;
+            break;
+        case 3:
+            name1 = strVal(linitial(cref->fields));
+            name2 = strVal(lsecond(cref->fields));
+            if(IsA(lthird(cref->fields), A_Star)){
+                name3 = "*";
+                nnamesWholerow = 2;
+                break;
+            }
+            name3 = strVal(lthird(cref->fields));
+            colname = name3;
+            nnamesField = 2;
+            break;
+        default:
+            return -1;
+    }
+
+    item = lookupNamespaceItem(context->expr->ns,name1,name2,name3,&nnames);
+    if(item == NULL)
+        return -1;
+
+    switch(item->itemtype){
+        case PLPGSQL_NSTYPE_VAR:
+            if(nnames == nnamesScalar)
+                return item->itemno;
+            break;
+        case PLPGSQL_NSTYPE_REC:
+            if(nnames == nnamesWholerow)
+                return item->itemno;
+            /* fields of records have datums of their own */
+            if(nnames == nnamesField){
+                for(int dno=0;dno<context->ndatums;dno++){
+                    PLpgSQL_recfield* field = (PLpgSQL_recfield*) context->datums[dno];
+
+                    if(field->dtype == PLPGSQL_DTYPE_RECFIELD &&
+                       field->recparentno == item->itemno &&
+                       strcmp(field->fieldname,colname) == 0)
+                        return dno;
+                }
+            }
+            break;
+        case PLPGSQL_NSTYPE_ROW:
+            if(nnames == nnamesWholerow)
+                return item->itemno;
+            if(nnames == nnamesField){
+                PLpgSQL_row* row = (PLpgSQL_row*) context->datums[item->itemno];
+
+                for(int i=0;i<row->nfields;i++){
+                    if(row->fieldnames[i] && strcmp(row->fieldnames[i],colname) == 0)
+                        return row->varnos[i];
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return -1;
+}
+
+
+/**
+ * Raw parse tree walker that collects the datums referenced by column
+ * references and positional parameters
+ */
+static bool collectReferencedDatums(Node* node, struct referenced_datums* context){
+
+    if(node == NULL)
+        return false;
+
+    if(IsA(node, ColumnRef)){
+        ColumnRef*  cref = (ColumnRef*) node;
+        int         dno;
+
+        if(!IsA(linitial(cref->fields), String))
+            return false;
+
+        dno = resolveColumnRef(cref,context);
+
+        /* with variable_conflict = use_column, columns hide variables */
+        if(dno >= 0 &&
+           context->function->resolve_option == PLPGSQL_RESOLVE_COLUMN &&
+           isTableColumn(cref,context))
+            dno = -1;
+
+        if(dno >= 0)
+            context->dnos = bms_add_member(context->dnos,dno);
+        return false;
+    }
+
+    if(IsA(node, ParamRef)){
+        ParamRef*       pref = (ParamRef*) node;
+        PLpgSQL_nsitem* item;
+        char            name[32];
+        int             nnames;
+
+        /* $n is resolved in the namespace, like plpgsql_param_ref does */
+        snprintf(name, sizeof(name), "$%d", pref->number);
+        item = lookupNamespaceItem(context->expr->ns,name,NULL,NULL,&nnames);
+        if(item != NULL)
+            context->dnos = bms_add_member(context->dnos,item->itemno);
+        return false;
+    }
+
+    return raw_expression_tree_walker(node,collectReferencedDatums,(void*) context);
+}
+
+
+/**
+ * Raw parse tree walker that collects the tables of a query
+ */
+static bool collectRelations(Node* node, struct referenced_datums* context){
+
+    if(node == NULL)
+        return false;
+
+    if(IsA(node, RangeVar))
+        context->relations = lappend(context->relations, node);
+
+    return raw_expression_tree_walker(node,collectRelations,(void*) context);
+}
+
+
+/**
+ * Get the parameters of a query as Bitmapset
+ *
+ * The query is raw parsed and its column references and positional
+ * parameters are resolved in the namespace of the expression by the rules
+ * of plpgsql, whether the statement was executed already or not. Graphs
+ * built inline and by the background worker are the same therefore.
+ * Column references that may name a table column are resolved by a
+ * catalog lookup if the function uses variable_conflict = use_column.
  */
 Bitmapset* getParametersOfQueryExpr(PLpgSQL_expr*           expr,
                                     PLpgSQL_datum**         datums,
@@ -17,7 +271,42 @@ Bitmapset* getParametersOfQueryExpr(PLpgSQL_expr*           expr,
                                     PLpgSQL_function*       surroundingFunction,
                                     PLpgSQL_execstate*      estate){
 
-    return expr->paramnos;
+    struct referenced_datums context;
+    List*       parsetrees;
+    ListCell*   l;
+
+    if(expr == NULL)
+        return NULL;
+
+    context.expr = expr;
+    context.function = surroundingFunction;
+    context.datums = datums;
+    context.ndatums = ndatums;
+    context.relations = NIL;
+    context.dnos = NULL;
+
+    /* raises an error if the query does not parse, the caller catches it */
+    parsetrees = raw_parser(expr->query);
+
+    foreach(l, parsetrees){
+        Node* parsetree = (Node*) lfirst(l);
+
+        /* the walker only knows the raw trees of these statements */
+        switch(nodeTag(parsetree)){
+            case T_SelectStmt:
+            case T_InsertStmt:
+            case T_UpdateStmt:
+            case T_DeleteStmt:
+                if(surroundingFunction->resolve_option == PLPGSQL_RESOLVE_COLUMN)
+                    collectRelations(parsetree,&context);
+                collectReferencedDatums(parsetree,&context);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return context.dnos;
 }
 
 
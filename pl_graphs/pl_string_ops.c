@@ -30,8 +30,7 @@ char* removeFromString(char* string,char* toRemove){
  */
 char* removeFromStringN(const char* string,char* toRemove){
     /* copy the given string to a new string */
-    char* newString = palloc(strlen(string));
-    strncpy(newString,string,strlen(string));
+    char* newString = pstrdup(string);
     /* removes the substring */
     removeSubstring(newString,toRemove);
     return newString;
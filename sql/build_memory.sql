@@ -0,0 +1,43 @@
+--
+-- Graphs are built in a memory context of their own, build_memory is the
+-- most it held
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_build_small() RETURNS integer AS $$
+BEGIN
+    RETURN 1;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE FUNCTION pgpg_build_large() RETURNS integer AS $$
+DECLARE
+    a integer := 0;
+    b integer := 1;
+    c integer := 2;
+BEGIN
+    FOR i IN 1..3 LOOP
+        a := a + b;
+        IF a > c THEN
+            b := b + c;
+        ELSE
+            c := c + a;
+        END IF;
+        WHILE b > 100 LOOP
+            b := b - a;
+        END LOOP;
+    END LOOP;
+    RETURN a + b + c;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_build_small();
+SELECT pgpg_build_large();
+
+SELECT build_memory > 0 AS counted FROM pg_plsql_graphs('pgpg_build_small()');
+SELECT l.build_memory >= s.build_memory AS larger
+FROM pg_plsql_graphs('pgpg_build_small()') s, pg_plsql_graphs('pgpg_build_large()') l;
+
+RESET pg_plsql_graphs.capture;
+DROP FUNCTION pgpg_build_small();
+DROP FUNCTION pgpg_build_large();
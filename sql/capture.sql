@@ -0,0 +1,61 @@
+--
+-- pg_plsql_graphs.capture and pg_plsql_graphs.sample_rate
+--
+CREATE FUNCTION pgpg_capture_off(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 1;
+END;
+$$ LANGUAGE plpgsql;
+CREATE FUNCTION pgpg_capture_all(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 2;
+END;
+$$ LANGUAGE plpgsql;
+CREATE FUNCTION pgpg_capture_none(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 3;
+END;
+$$ LANGUAGE plpgsql;
+CREATE FUNCTION pgpg_capture_every(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 4;
+END;
+$$ LANGUAGE plpgsql;
+
+-- nothing is requested while capture is off
+SET pg_plsql_graphs.capture = 'off';
+SELECT pgpg_capture_off(1);
+SELECT count(*) FROM pg_plsql_graphs('pgpg_capture_off(integer)');
+
+-- all rebuilds the graphs within every call
+SET pg_plsql_graphs.capture = 'all';
+SELECT pgpg_capture_all(1);
+SELECT graph_id AS first_id FROM pg_plsql_graphs('pgpg_capture_all(integer)') \gset
+SELECT pgpg_capture_all(2);
+SELECT graph_id <> :first_id AS rebuilt FROM pg_plsql_graphs('pgpg_capture_all(integer)');
+
+-- sampled looks at the fraction sample_rate of the calls
+SET pg_plsql_graphs.capture = 'sampled';
+SET pg_plsql_graphs.sample_rate = 0;
+SELECT pgpg_capture_none(1);
+SELECT count(*) FROM pg_plsql_graphs('pgpg_capture_none(integer)');
+SET pg_plsql_graphs.sample_rate = 1;
+SELECT pgpg_capture_every(1);
+SELECT pgpg_wait_for_graph('pgpg_capture_every(integer)');
+
+-- both can be set by any user
+CREATE ROLE regress_pgpg_capture;
+SET ROLE regress_pgpg_capture;
+SET pg_plsql_graphs.capture = 'off';
+SET pg_plsql_graphs.sample_rate = 0.5;
+SHOW pg_plsql_graphs.capture;
+SHOW pg_plsql_graphs.sample_rate;
+RESET ROLE;
+DROP ROLE regress_pgpg_capture;
+
+RESET pg_plsql_graphs.capture;
+RESET pg_plsql_graphs.sample_rate;
+DROP FUNCTION pgpg_capture_off(integer);
+DROP FUNCTION pgpg_capture_all(integer);
+DROP FUNCTION pgpg_capture_none(integer);
+DROP FUNCTION pgpg_capture_every(integer);
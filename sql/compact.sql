@@ -0,0 +1,36 @@
+--
+-- Compact dot is written in a single line and keeps the labels intact
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_compact() RETURNS text AS $$
+DECLARE
+    s text := 'a';
+BEGIN
+    IF length(s) < 3 THEN
+        s := s ||
+             'b';
+    END IF;
+    RETURN s;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_compact();
+RESET pg_plsql_graphs.capture;
+
+SELECT strpos(flow_graph_dot, E'\n') = 0 AND strpos(flow_graph_dot, E'\t') = 0 AS flow_one_line,
+       strpos(program_dependence_graph_dot, E'\n') = 0 AS pdg_one_line,
+       strpos(flow_graph_dot, '||') > 0 AS bars_kept,
+       flow_graph_dot LIKE 'digraph g{%}' AS whole
+FROM pg_plsql_graphs_trimmed WHERE function_name = 'pgpg_compact()';
+
+-- the same graph as the untrimmed dot
+SELECT length(t.flow_graph_dot) < length(g.flow_graph_dot) AS shorter,
+       strpos(g.flow_graph_dot, E'\n') > 0 AS untrimmed_lines
+FROM pg_plsql_graphs_trimmed t JOIN pg_plsql_graphs g USING (function_name)
+WHERE function_name = 'pgpg_compact()';
+
+SELECT strpos(pg_plsql_graph_dot(graph_id, compact => true), E'\n') = 0 AS one_line
+FROM pg_plsql_graphs('pgpg_compact()');
+
+DROP FUNCTION pgpg_compact();
@@ -0,0 +1,44 @@
+--
+-- Entries are shared by functions of the same source and parameters
+--
+CREATE FUNCTION pgpg_dedup_a(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN $1;
+END;
+$$ LANGUAGE plpgsql;
+CREATE FUNCTION pgpg_dedup_b(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN $1;
+END;
+$$ LANGUAGE plpgsql;
+-- other parameter names or types make other entries
+CREATE FUNCTION pgpg_dedup_c(b integer) RETURNS integer AS $$
+BEGIN
+    RETURN $1;
+END;
+$$ LANGUAGE plpgsql;
+CREATE FUNCTION pgpg_dedup_d(a bigint) RETURNS bigint AS $$
+BEGIN
+    RETURN $1;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_dedup_a(1);
+SELECT pgpg_wait_for_graph('pgpg_dedup_a(integer)');
+SELECT pgpg_dedup_b(1);
+SELECT pgpg_wait_for_graph('pgpg_dedup_b(integer)');
+SELECT pgpg_dedup_c(1);
+SELECT pgpg_wait_for_graph('pgpg_dedup_c(integer)');
+SELECT pgpg_dedup_d(1);
+SELECT pgpg_wait_for_graph('pgpg_dedup_d(bigint)');
+
+SELECT function_name, calls FROM pg_plsql_graphs('pgpg_dedup_b(integer)');
+SELECT count(DISTINCT g.graph_id)
+  FROM unnest(ARRAY['pgpg_dedup_a(integer)', 'pgpg_dedup_b(integer)',
+                    'pgpg_dedup_c(integer)', 'pgpg_dedup_d(bigint)']::regprocedure[]) f,
+       pg_plsql_graphs(f) g;
+
+DROP FUNCTION pgpg_dedup_a(integer);
+DROP FUNCTION pgpg_dedup_b(integer);
+DROP FUNCTION pgpg_dedup_c(integer);
+DROP FUNCTION pgpg_dedup_d(bigint);
@@ -0,0 +1,45 @@
+--
+-- The dot of large functions is not cut off and labels are escaped
+--
+SET pg_plsql_graphs.capture = 'all';
+
+DO $$
+BEGIN
+    EXECUTE format($f$
+CREATE FUNCTION pgpg_dot_large() RETURNS integer AS $b$
+DECLARE
+    s integer := 0;
+BEGIN
+%s
+    RETURN s;
+END;
+$b$ LANGUAGE plpgsql
+$f$, (SELECT string_agg(format('    s := s + %s;', i), E'\n') FROM generate_series(1, 300) i));
+END;
+$$;
+
+CREATE FUNCTION pgpg_dot_quotes() RETURNS text AS $$
+DECLARE
+    s text;
+BEGIN
+    s := 'say "hi" \ ';
+    RETURN s;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_dot_large();
+SELECT pgpg_dot_quotes();
+RESET pg_plsql_graphs.capture;
+
+SELECT length(flow_graph_dot) > 4096 AS long_dot,
+       flow_graph_dot LIKE '%s := s + 300%' AS last_statement,
+       rtrim(flow_graph_dot, E'\n') LIKE '%}' AS closed
+FROM pg_plsql_graphs('pgpg_dot_large()');
+SELECT count(*) FROM pg_plsql_graph_nodes('pgpg_dot_large()'::regprocedure);
+
+-- quotes and backslashes in labels are escaped
+SELECT strpos(flow_graph_dot, 's := ''say \"hi\" \\ ''') > 0 AS escaped
+FROM pg_plsql_graphs('pgpg_dot_quotes()');
+
+DROP FUNCTION pgpg_dot_large();
+DROP FUNCTION pgpg_dot_quotes();
@@ -0,0 +1,43 @@
+--
+-- Eviction of the least used graphs, pg_plsql_graphs.conf sets
+-- pg_plsql_graphs.max to 100
+--
+SHOW pg_plsql_graphs.max;
+
+CREATE FUNCTION pgpg_hot(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a * 2;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_hot(1);
+SELECT pgpg_wait_for_graph('pgpg_hot(integer)');
+SELECT count(pgpg_hot(i)) FROM generate_series(1, 50) i;
+
+-- more functions than the hash table holds
+SET pg_plsql_graphs.capture = 'all';
+DO $$
+BEGIN
+    FOR i IN 1..120 LOOP
+        EXECUTE format('CREATE FUNCTION pgpg_evict_%s() RETURNS integer AS '
+                       '$f$ BEGIN RETURN %s; END; $f$ LANGUAGE plpgsql', i, i);
+        EXECUTE format('SELECT pgpg_evict_%s()', i);
+    END LOOP;
+END;
+$$;
+RESET pg_plsql_graphs.capture;
+
+SELECT evictions > 0 AS evicted FROM pg_plsql_graphs_stats;
+SELECT count(*) <= 100 AS bounded FROM pg_plsql_graphs;
+
+-- the frequently called function is kept
+SELECT function_name, calls FROM pg_plsql_graphs('pgpg_hot(integer)');
+
+DO $$
+BEGIN
+    FOR i IN 1..120 LOOP
+        EXECUTE format('DROP FUNCTION pgpg_evict_%s()', i);
+    END LOOP;
+END;
+$$;
+DROP FUNCTION pgpg_hot(integer);
@@ -0,0 +1,49 @@
+--
+-- Graphs of one function and graphs filtered by caller, name and time
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_filter_a() RETURNS integer AS $$
+BEGIN
+    RETURN 11;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE FUNCTION pgpg_filter_b() RETURNS integer AS $$
+BEGIN
+    RETURN 12;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_filter_a();
+SELECT pg_sleep(0.1);
+SELECT now() AS between_calls \gset
+SELECT pgpg_filter_b();
+RESET pg_plsql_graphs.capture;
+
+-- by function
+SELECT function_name FROM pg_plsql_graphs('pgpg_filter_a()');
+SELECT count(*) FROM pg_plsql_graphs('pgpg_wait_for_graph(regprocedure)');
+
+-- by name pattern
+SELECT function_name FROM pg_plsql_graphs_filtered(name_pattern => 'pgpg\_filter\_%')
+ORDER BY function_name;
+
+-- by database and user
+SELECT function_name
+FROM pg_plsql_graphs_filtered((SELECT oid FROM pg_database WHERE datname = current_database()),
+                              (SELECT oid FROM pg_roles WHERE rolname = current_user),
+                              'pgpg\_filter\_%')
+ORDER BY function_name;
+SELECT count(*)
+FROM pg_plsql_graphs_filtered((SELECT oid FROM pg_database WHERE datname = 'template1'),
+                              NULL, 'pgpg\_filter\_%');
+
+-- by the time of the last call
+SELECT function_name
+FROM pg_plsql_graphs_filtered(name_pattern => 'pgpg\_filter\_%', since => :'between_calls');
+SELECT count(*)
+FROM pg_plsql_graphs_filtered(name_pattern => 'pgpg\_filter\_%', since => now() + interval '1 hour');
+
+DROP FUNCTION pgpg_filter_a();
+DROP FUNCTION pgpg_filter_b();
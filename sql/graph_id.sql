@@ -0,0 +1,34 @@
+--
+-- Graphs are stored compact and rendered to dot when they are read
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_graph_id() RETURNS integer AS $$
+DECLARE
+    s integer := 0;
+    t integer := 3;
+BEGIN
+    s := t + 1;
+    IF s > 10 THEN
+        s := s - 10;
+    END IF;
+    RETURN s;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_graph_id();
+SELECT graph_id AS gid FROM pg_plsql_graphs('pgpg_graph_id()') \gset
+SELECT function_name FROM pg_plsql_graphs WHERE graph_id = :gid;
+SELECT pg_plsql_graph_dot(:gid) LIKE 'digraph g {%' AS dot,
+       pg_plsql_graph_dot(:gid, '{FLOW,WR-DEPENDENCE}', false, true) LIKE 'digraph g {%' AS options;
+
+-- unknown graph ids
+SELECT pg_plsql_graph_dot(-1) IS NULL AS dot;
+
+-- a rebuild gets a new graph id, the old one is gone
+SELECT pgpg_graph_id();
+SELECT graph_id <> :gid AS new_id FROM pg_plsql_graphs('pgpg_graph_id()');
+SELECT pg_plsql_graph_dot(:gid) IS NULL AS old_id_gone;
+
+RESET pg_plsql_graphs.capture;
+DROP FUNCTION pgpg_graph_id();
@@ -0,0 +1,6 @@
+--
+-- Lock waits per partition of the graph store
+--
+SELECT count(*), count(DISTINCT partition) AS partitions,
+       min(partition), max(partition), bool_and(waits >= 0) AS counted
+FROM pg_plsql_graphs_lock_waits();
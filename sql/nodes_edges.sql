@@ -0,0 +1,49 @@
+--
+-- Nodes and edges of a stored graph as rows
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_nodes_edges() RETURNS integer AS $$
+DECLARE
+    a integer := 1;
+    b integer;
+BEGIN
+    b := a + 1;
+    IF b > 1 THEN
+        b := 0;
+    END IF;
+    RETURN b;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_nodes_edges();
+RESET pg_plsql_graphs.capture;
+SELECT graph_id AS gid FROM pg_plsql_graphs('pgpg_nodes_edges()') \gset
+
+SELECT node, statement_kind, lineno, read_variables, write_variables
+FROM pg_plsql_graph_nodes('pgpg_nodes_edges()'::regprocedure) ORDER BY node;
+SELECT from_node, to_node, kind, label
+FROM pg_plsql_graph_edges('pgpg_nodes_edges()'::regprocedure)
+ORDER BY kind, from_node, to_node;
+
+-- the graph id gives the same rows
+SELECT count(*) FROM (
+    SELECT * FROM pg_plsql_graph_edges(:gid::bigint)
+    EXCEPT SELECT * FROM pg_plsql_graph_edges('pgpg_nodes_edges()'::regprocedure)) d;
+
+-- statements after the IF along the flow edges
+WITH RECURSIVE after(node) AS (
+    SELECT to_node FROM pg_plsql_graph_edges(:gid::bigint)
+    WHERE kind = 'FLOW' AND from_node = 2
+  UNION
+    SELECT e.to_node FROM pg_plsql_graph_edges(:gid::bigint) e, after a
+    WHERE e.kind = 'FLOW' AND e.from_node = a.node
+)
+SELECT n.lineno FROM after a JOIN pg_plsql_graph_nodes(:gid::bigint) n USING (node)
+ORDER BY n.lineno;
+
+-- graphs that are not stored
+SELECT count(*) FROM pg_plsql_graph_nodes(-1::bigint);
+SELECT count(*) FROM pg_plsql_graph_edges('pgpg_wait_for_graph(regprocedure)'::regprocedure);
+
+DROP FUNCTION pgpg_nodes_edges();
@@ -0,0 +1,49 @@
+--
+-- pg_plsql_graphs
+--
+-- The library must be in shared_preload_libraries. The graphs of a
+-- function version are built once, by a background worker after its first
+-- call. pgpg_wait_for_graph() waits until they are stored, the other tests
+-- use it as well.
+--
+CREATE EXTENSION pg_plsql_graphs;
+
+CREATE FUNCTION pgpg_wait_for_graph(fn regprocedure) RETURNS boolean AS $$
+BEGIN
+    FOR i IN 1..300 LOOP
+        IF EXISTS (SELECT 1 FROM pg_plsql_graphs(fn)) THEN
+            RETURN true;
+        END IF;
+        PERFORM pg_sleep(0.1);
+    END LOOP;
+    RETURN false;
+END;
+$$ LANGUAGE plpgsql SET pg_plsql_graphs.capture = 'off';
+
+CREATE FUNCTION pgpg_version(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 1;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_version(1);
+SELECT pgpg_wait_for_graph('pgpg_version(integer)');
+
+-- later calls of the same version are only counted
+SELECT pgpg_version(2);
+SELECT pgpg_version(3);
+SELECT function_name, calls FROM pg_plsql_graphs('pgpg_version(integer)');
+
+-- a new version gets graphs of its own
+CREATE OR REPLACE FUNCTION pgpg_version(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 2;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_version(1);
+SELECT pgpg_wait_for_graph('pgpg_version(integer)');
+SELECT function_name, calls FROM pg_plsql_graphs('pgpg_version(integer)');
+SELECT count(*) FROM pg_plsql_graphs WHERE function_name = 'pgpg_version(integer)';
+
+DROP FUNCTION pgpg_version(integer);
@@ -0,0 +1,44 @@
+--
+-- Reachability over the flow edges, by node id and by line
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_reachable() RETURNS integer AS $$
+DECLARE
+    s integer := 0;
+BEGIN
+    FOR i IN 1..3 LOOP
+        s := s + i;
+    END LOOP;
+    IF s > 10 THEN
+        s := 0;
+    END IF;
+    RETURN s;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_reachable();
+RESET pg_plsql_graphs.capture;
+SELECT graph_id AS gid FROM pg_plsql_graphs('pgpg_reachable()') \gset
+SELECT node, statement_kind, lineno
+FROM pg_plsql_graph_nodes(:gid::bigint) ORDER BY node;
+
+-- by node id, a node reaches itself only in a loop
+SELECT pg_plsql_reachable(:gid::bigint, 0, 5) AS forward,
+       pg_plsql_reachable(:gid::bigint, 5, 1) AS backward,
+       pg_plsql_reachable(:gid::bigint, 2, 2) AS loop,
+       pg_plsql_reachable(:gid::bigint, 3, 3) AS no_loop;
+SELECT pg_plsql_reachable(:gid::bigint, 0, 6);
+
+-- by the lines the statements start at
+SELECT pg_plsql_reachable('pgpg_reachable()'::regprocedure, 5, 11) AS forward,
+       pg_plsql_reachable('pgpg_reachable()'::regprocedure, 11, 5) AS backward,
+       pg_plsql_reachable('pgpg_reachable()'::regprocedure, 6, 6) AS loop,
+       pg_plsql_reachable('pgpg_reachable()'::regprocedure, 9, 6) AS after_loop;
+SELECT pg_plsql_reachable('pgpg_reachable()'::regprocedure, 7, 11);
+
+-- graphs that are not stored
+SELECT pg_plsql_reachable(-1::bigint, 0, 1) IS NULL AS unknown_id,
+       pg_plsql_reachable('pgpg_wait_for_graph(regprocedure)'::regprocedure, 1, 2) IS NULL AS not_captured;
+
+DROP FUNCTION pgpg_reachable();
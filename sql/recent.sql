@@ -0,0 +1,28 @@
+--
+-- Ring of the latest captures
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_recent() RETURNS integer AS $$
+BEGIN
+    RETURN 5;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_recent();
+RESET pg_plsql_graphs.capture;
+SELECT graph_id AS gid FROM pg_plsql_graphs('pgpg_recent()') \gset
+
+SELECT function_name, graph_id = :gid AS same_graph, pid = pg_backend_pid() AS own_pid,
+       flow_graph_dot LIKE 'digraph g {%' AS dot
+FROM pg_plsql_recent_graphs(1, true);
+SELECT flow_graph_dot LIKE 'digraph g{%' AS compact_dot
+FROM pg_plsql_recent_graphs(1, true, true);
+SELECT count(*) FROM pg_plsql_recent_graphs(0);
+SELECT count(*) FROM pg_plsql_recent_graphs(65);
+
+-- the views of the last capture
+SELECT flow_graph_dot LIKE 'digraph g{%' AS dot FROM pg_plsql_last_flowgraph_dot;
+SELECT program_dependence_graph_dot LIKE 'digraph g{%' AS dot FROM pg_plsql_last_pdgs_dot;
+
+DROP FUNCTION pgpg_recent();
@@ -0,0 +1,36 @@
+--
+-- Activity counters and stage latencies
+--
+CREATE FUNCTION pgpg_stats() RETURNS bigint AS $$
+DECLARE
+    n bigint;
+BEGIN
+    PERFORM 1;
+    GET DIAGNOSTICS n = ROW_COUNT;
+    RETURN n;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pg_plsql_graphs_stats_reset();
+SELECT captures, cache_hits, bytes_stored, truncated, unsupported_statements,
+       stats_reset > now() - interval '1 minute' AS reset
+FROM pg_plsql_graphs_stats;
+SELECT stage, calls, total_time, array_length(histogram, 1) AS buckets
+FROM pg_plsql_graphs_stage_latency ORDER BY stage;
+
+-- the GET DIAGNOSTICS statement is left out of the graph and counted
+SET pg_plsql_graphs.capture = 'all';
+SELECT pgpg_stats();
+RESET pg_plsql_graphs.capture;
+
+-- the next call finds its graph stored
+SELECT pgpg_stats();
+
+SELECT captures, cache_hits >= 1 AS hits, bytes_stored > 0 AS stored,
+       unsupported_statements
+FROM pg_plsql_graphs_stats;
+SELECT stage, calls,
+       calls = (SELECT sum(b) FROM unnest(histogram) b) AS histogram_complete
+FROM pg_plsql_graphs_stage_latency WHERE stage <> 'render' ORDER BY stage;
+
+DROP FUNCTION pgpg_stats();
@@ -0,0 +1,56 @@
+--
+-- Graphs are stored compressed, those beyond the storage budget keep
+-- only their names
+--
+SET pg_plsql_graphs.capture = 'all';
+
+-- two functions of 300 statements
+DO $$
+DECLARE
+    f record;
+BEGIN
+    FOR f IN SELECT * FROM (VALUES ('pgpg_storage', '+'), ('pgpg_storage_truncated', '-')) v(fn, op) LOOP
+        EXECUTE format($f$
+CREATE FUNCTION %s() RETURNS integer AS $b$
+DECLARE
+    n integer := 0;
+BEGIN
+%s
+    RETURN n;
+END;
+$b$ LANGUAGE plpgsql
+$f$, f.fn, (SELECT string_agg(format('    n := n %s %s;', f.op, i), E'\n')
+            FROM generate_series(1, 300) i));
+    END LOOP;
+END;
+$$;
+
+SELECT pgpg_storage();
+SELECT stored_bytes > 0 AS stored,
+       compression_ratio > 1 AS compressed,
+       flow_graph_dot IS NOT NULL AS dot
+FROM pg_plsql_graphs('pgpg_storage()');
+
+-- a budget too small for the graph
+ALTER SYSTEM SET pg_plsql_graphs.storage_budget = 1;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.5);
+SHOW pg_plsql_graphs.storage_budget;
+
+SELECT truncated AS truncated_before FROM pg_plsql_graphs_stats \gset
+SELECT pgpg_storage_truncated();
+SELECT stored_bytes > 0 AS stored,
+       compression_ratio IS NULL AS no_ratio,
+       flow_graph_dot IS NULL AS no_dot,
+       program_dependence_graph_dot IS NULL AS no_pdg_dot
+FROM pg_plsql_graphs('pgpg_storage_truncated()');
+SELECT truncated > :truncated_before AS counted FROM pg_plsql_graphs_stats;
+
+ALTER SYSTEM RESET pg_plsql_graphs.storage_budget;
+SELECT pg_reload_conf();
+SELECT pg_sleep(0.5);
+SHOW pg_plsql_graphs.storage_budget;
+
+RESET pg_plsql_graphs.capture;
+DROP FUNCTION pgpg_storage();
+DROP FUNCTION pgpg_storage_truncated();
@@ -0,0 +1,33 @@
+--
+-- Update from 1.0 to 1.1
+--
+DROP EXTENSION pg_plsql_graphs;
+CREATE EXTENSION pg_plsql_graphs VERSION '1.0';
+SELECT extversion FROM pg_extension WHERE extname = 'pg_plsql_graphs';
+ALTER EXTENSION pg_plsql_graphs UPDATE TO '1.1';
+SELECT extversion FROM pg_extension WHERE extname = 'pg_plsql_graphs';
+
+-- the updated extension has the same objects as a fresh install of 1.1
+CREATE TEMP TABLE pgpg_updated AS
+SELECT pg_describe_object(classid, objid, objsubid) AS object
+FROM pg_depend
+WHERE refclassid = 'pg_extension'::regclass AND deptype = 'e' AND
+      refobjid = (SELECT oid FROM pg_extension WHERE extname = 'pg_plsql_graphs');
+SELECT count(*) > 0 AS has_objects FROM pgpg_updated;
+
+DROP EXTENSION pg_plsql_graphs;
+CREATE EXTENSION pg_plsql_graphs;
+CREATE TEMP TABLE pgpg_installed AS
+SELECT pg_describe_object(classid, objid, objsubid) AS object
+FROM pg_depend
+WHERE refclassid = 'pg_extension'::regclass AND deptype = 'e' AND
+      refobjid = (SELECT oid FROM pg_extension WHERE extname = 'pg_plsql_graphs');
+
+(SELECT object FROM pgpg_updated EXCEPT SELECT object FROM pgpg_installed)
+UNION ALL
+(SELECT object FROM pgpg_installed EXCEPT SELECT object FROM pgpg_updated);
+
+-- stats_reset is not granted to PUBLIC after the update either
+SELECT has_function_privilege('public', 'pg_plsql_graphs_stats_reset()', 'execute') AS public_reset;
+
+DROP EXTENSION pg_plsql_graphs;
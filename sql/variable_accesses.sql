@@ -0,0 +1,32 @@
+--
+-- Statements reading and writing a variable
+--
+SET pg_plsql_graphs.capture = 'all';
+
+CREATE FUNCTION pgpg_accesses() RETURNS integer AS $$
+DECLARE
+    s integer := 0;
+    t integer := 2;
+BEGIN
+    s := t + 1;
+    IF s > 10 THEN
+        s := s - 10;
+    END IF;
+    RETURN s;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_accesses();
+RESET pg_plsql_graphs.capture;
+SELECT graph_id AS gid FROM pg_plsql_graphs('pgpg_accesses()') \gset
+
+SELECT variable, node, access
+FROM pg_plsql_variable_accesses(:gid) ORDER BY variable, access, node;
+SELECT variable, node, access
+FROM pg_plsql_variable_accesses(:gid, 't') ORDER BY node;
+
+-- graphs that are not stored
+SELECT count(*) FROM pg_plsql_variable_accesses(-1);
+SELECT count(*) FROM pg_plsql_variable_accesses(NULL);
+
+DROP FUNCTION pgpg_accesses();
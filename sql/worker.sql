@@ -0,0 +1,54 @@
+--
+-- Graphs built by the background worker
+--
+CREATE TABLE pgpg_worker_t (id integer, v integer);
+INSERT INTO pgpg_worker_t VALUES (7, 1);
+
+-- v names the column in the query, w the variable
+CREATE FUNCTION pgpg_worker() RETURNS integer AS $$
+#variable_conflict use_column
+DECLARE
+    v integer := 0;
+    w integer := 1;
+    r integer;
+BEGIN
+    SELECT id INTO r FROM pgpg_worker_t WHERE v = w;
+    RETURN r;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT pgpg_worker();
+SELECT pgpg_wait_for_graph('pgpg_worker()');
+
+-- the worker stores the graphs on behalf of the calling user and database
+SELECT calls,
+       userids = ARRAY[(SELECT oid FROM pg_roles WHERE rolname = current_user)] AS userids,
+       dbids = ARRAY[(SELECT oid FROM pg_database WHERE datname = current_database())] AS dbids
+FROM pg_plsql_graphs('pgpg_worker()');
+SELECT node, statement_kind, lineno, read_variables, write_variables
+FROM pg_plsql_graph_nodes('pgpg_worker()'::regprocedure) ORDER BY node;
+
+-- a build within the call gives the same graphs
+CREATE TEMP TABLE pgpg_worker_nodes AS
+SELECT * FROM pg_plsql_graph_nodes('pgpg_worker()'::regprocedure);
+CREATE TEMP TABLE pgpg_worker_edges AS
+SELECT * FROM pg_plsql_graph_edges('pgpg_worker()'::regprocedure);
+SET pg_plsql_graphs.capture = 'all';
+SELECT pgpg_worker();
+RESET pg_plsql_graphs.capture;
+
+SELECT count(*) FROM (
+    (SELECT * FROM pgpg_worker_nodes
+     EXCEPT SELECT * FROM pg_plsql_graph_nodes('pgpg_worker()'::regprocedure))
+    UNION ALL
+    (SELECT * FROM pg_plsql_graph_nodes('pgpg_worker()'::regprocedure)
+     EXCEPT SELECT * FROM pgpg_worker_nodes)) d;
+SELECT count(*) FROM (
+    (SELECT * FROM pgpg_worker_edges
+     EXCEPT SELECT * FROM pg_plsql_graph_edges('pgpg_worker()'::regprocedure))
+    UNION ALL
+    (SELECT * FROM pg_plsql_graph_edges('pgpg_worker()'::regprocedure)
+     EXCEPT SELECT * FROM pgpg_worker_edges)) d;
+
+DROP FUNCTION pgpg_worker();
+DROP TABLE pgpg_worker_t;
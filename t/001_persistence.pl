@@ -0,0 +1,49 @@
+# Graphs saved at shutdown are loaded at the next start, lookups by
+# function included
+use strict;
+use warnings;
+use TestLib;
+use Test::More tests => 4;
+
+my $tempdir = TestLib::tempdir;
+
+start_test_server($tempdir);
+
+open my $conf, '>>', "$tempdir/pgdata/postgresql.conf"
+  or die "could not open postgresql.conf: $!";
+print $conf "shared_preload_libraries = 'pg_plsql_graphs'\n";
+close $conf;
+restart_test_server();
+
+psql 'postgres', q{
+CREATE EXTENSION pg_plsql_graphs;
+CREATE FUNCTION pgpg_saved(a integer) RETURNS integer AS $$
+BEGIN
+    RETURN a + 1;
+END;
+$$ LANGUAGE plpgsql;
+SET pg_plsql_graphs.capture = 'all';
+SELECT pgpg_saved(1);
+};
+
+my $graph = q{SELECT function_name || ' ' || calls
+	FROM pg_plsql_graphs('pgpg_saved(integer)')};
+my $nodes = q{SELECT count(*)
+	FROM pg_plsql_graph_nodes('pgpg_saved(integer)'::regprocedure)};
+
+is(psql('postgres', $graph), 'pgpg_saved(integer) 1', 'graph is stored');
+
+restart_test_server();
+
+is(psql('postgres', $graph), 'pgpg_saved(integer) 1',
+	'graph and counters are loaded and found by function');
+is(psql('postgres', $nodes), '2', 'image is loaded');
+
+# nothing is saved with pg_plsql_graphs.save off
+psql 'postgres', q{
+ALTER SYSTEM SET pg_plsql_graphs.save = off;
+SELECT pg_reload_conf();
+};
+restart_test_server();
+
+is(psql('postgres', $graph), '', 'graphs are not saved');